@@ -8,6 +8,12 @@
 
 #include "RawDataInput.h"
 
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
 namespace spd = spdlog;
 
 double const next::RawDataInput::CLOCK_TICK_ = 0.025;
@@ -19,13 +25,16 @@ next::RawDataInput::RawDataInput()
 
 next::RawDataInput::RawDataInput(ReadConfig * config, HDF5Writer * writer) :
 	run_(0),
-	cfptr_(),
+	input_(),
 	entriesThisFile_(-1),
 	event_(),
 	eventNo_(0),
 	skip_(config->skip()),
 	max_events_(config->max_events()),
 	buffer_(NULL),
+	events_(config->events()),
+	follow_(config->follow()),
+	streamSubEvents_(config->streamSubEvents()),
 	dualChannels(48,0),
 	verbosity_(config->verbosity()),
 	headOut_(),
@@ -48,87 +57,41 @@ next::RawDataInput::RawDataInput(ReadConfig * config, HDF5Writer * writer) :
 	}
 	_writer = writer;
 
-	payloadSipm = (char*) malloc(MEMSIZE*NUM_FEC_SIPM);
 	config_ = config;
 
-	// Initialize huffman to NULL
-	huffmanPmt_.next[0] = NULL;
-	huffmanPmt_.next[1] = NULL;
+	// Huffman codes are loaded with the first compressed data of each run
+	huffmanPmtRun_  = -1;
+	huffmanSipmRun_ = -1;
 
-	huffmanSipm_.next[0] = NULL;
-	huffmanSipm_.next[1] = NULL;
+	if (config->decodeThreads() > 1){
+		decodePool_.reset(new next::ThreadPool(config->decodeThreads()));
+	}
 }
 
 
-Huffman* next::RawDataInput::getHuffmanTree(){
+HuffmanTable* next::RawDataInput::getHuffmanTree(){
 	return &huffmanPmt_;
 }
 
-void next::RawDataInput::countEvents(std::FILE* file, int * nevents, int * firstEvt){
-	*nevents = 0;
-	*firstEvt = 0;
-	unsigned char * buffer;
-
-	*firstEvt = loadNextEvent(file, &buffer);
-	free(buffer);
-	int evt_number= *firstEvt;
-
-	while(evt_number > 0){
-		(*nevents)++;
-		evt_number = loadNextEvent(file, &buffer);
-		// If loadNextEvent enter in the first if, there is no malloc
-		// and then free will give a segfault
-		if (evt_number > 0){
-			free(buffer);
-		}
-	}
-}
-
-//Loads one event from the file
-int next::RawDataInput::loadNextEvent(std::FILE* file, unsigned char ** buffer){
-	int evt_number = -1;
-
-	eventHeaderStruct header;
-	unsigned int headerSize = sizeof(eventHeaderStruct);
-	unsigned int readSize = this->readHeaderSize(file);
-	if ((readSize != headerSize) && readSize) { //if we read 0 is the end of the file
-		//TODO throw art::Exception(art::errors::FileReadError;)
-		//_logerr->error("Event header size of {} bytes read from data does not match expected size of {}", readSize, headerSize);
-		return -1;
-	}
-
-	size_t bytes_read = fread(&header, 1, headerSize, file);
-	while (bytes_read == headerSize){
-		if (!isEventSelected(header)){
-			fseek(file, header.eventSize-headerSize, SEEK_CUR);
-		}else{
-			*buffer = (unsigned char *) malloc(header.eventSize);
-			//Come back to the init of event
-			fseek(file, -(long)headerSize, SEEK_CUR);
-			bytes_read = fread(*buffer, 1, header.eventSize, file);
-			//bytes_read += fread(*buffer, 1, header.eventSize-(long)headerSize, file);
-			if (bytes_read != header.eventSize ){
-				//TODO throw art::Exception(art::errors::FileReadError)
-				_logerr->error("Unable to read event from file");
+next::DATEStream* next::RawDataInput::openDATEStream(std::vector<std::string> const & filenames){
+	std::string const & filename = filenames[0];
+	_log->debug("Open file: {}", filename);
+	next::DATEStream* stream = new next::DATEStream(filenames, config_, input_->bufferPool());
+	if ( !stream->open() ){
+		bool opened = false;
+		if (follow_){
+			// The DAQ may not have created the file yet
+			_log->warn("Unable to open specified DATE file {}. Waiting for it up to {} seconds...", filename, config_->followTimeout());
+			for (int waited=0; waited<config_->followTimeout() && !opened; waited++){
+				sleep(1);
+				opened = stream->open();
 			}
-			evt_number = EVENT_ID_GET_NB_IN_RUN(header.eventId);
-			//std::cout << "evt number: " << evt_number << std::endl;
-			break;
+		}else{
+			_log->warn("Unable to open specified DATE file {}. Retrying in 10 seconds...", filename);
+			sleep(10);
+			opened = stream->open();
 		}
-		bytes_read = fread(&header, 1, headerSize, file);
-	}
-
-	return evt_number;
-}
-
-std::FILE* next::RawDataInput::openDATEFile(std::string const & filename){
-	_log->debug("Open file: {}", filename);
-	std::FILE* file = std::fopen(filename.c_str(), "rb");
-	if ( !file ){
-		_log->warn("Unable to open specified DATE file {}. Retrying in 10 seconds...", filename);
-		sleep(10);
-		file = std::fopen(filename.c_str(), "rb");
-		if ( !file ){
+		if ( !opened ){
 			_logerr->error("Unable to open specified DATE file {}", filename);
 			fileError_ = true;
 			exit(-1);
@@ -136,63 +99,49 @@ std::FILE* next::RawDataInput::openDATEFile(std::string const & filename){
 		_log->warn("File opened succesfully", filename);
 	}
 
-	return file;
+	return stream;
 }
 
+// filename can be a single file, a run directory or a glob pattern.
+// In the last two cases all the chunks of all the GDCs are read.
 void next::RawDataInput::readFile(std::string const & filename)
 {
-	bool gdc2first = false;
-
-	int nevents1=0, firstEvtGDC1;
-	int nevents2=0, firstEvtGDC2;
-	std::FILE* file1 = NULL;
-	std::FILE* file2 = NULL;
-	std::string filename2 = filename;
-
-	file1 = openDATEFile(filename);
-	countEvents(file1, &nevents1, &firstEvtGDC1);
-
-	if (twoFiles_){
-		filename2.replace(filename2.find("gdc1"), 4, "gdc2");
-		_log->info("Reading from files {} and {}", filename, filename2);
-
-		file2 = openDATEFile(filename2);
-		countEvents(file2, &nevents2, &firstEvtGDC2);
+	std::vector<std::vector<std::string> > gdcFiles = findRunFiles(filename, twoFiles_);
+	if (gdcFiles.empty()){
+		_logerr->error("No DATE files found in {}", filename);
+		fileError_ = true;
+		exit(-1);
+	}
 
-		//Check which gdc goes first
-		if (firstEvtGDC2 < firstEvtGDC1){
-			gdc2first = true;
+	input_ = new DATEMerger(config_);
+	for (auto const & files : gdcFiles){
+		if (files.size() > 1){
+			_log->info("Reading {} chunks: {} ... {}", files.size(), files.front(), files.back());
+		}else{
+			_log->info("Reading from file {}", files.front());
 		}
+		input_->addStream(openDATEStream(files));
 	}
 
-	entriesThisFile_ = nevents1 + nevents2;
-	if(max_events_ < entriesThisFile_){
+	int nevents = input_->buildIndex();
+	entriesThisFile_ = nevents;
+	if(!events_.empty()){
+		entriesThisFile_ = events_.size();
+	}else if(!input_->eventsKnown()){
+		// Unknown (follow mode or streams), read until the end of run
 		entriesThisFile_ = max_events_;
 	}
-	if(twoFiles_){
-		_log->info("Total events: {}, Events in file1: {}, file2: {}", entriesThisFile_, nevents1, nevents2);
-		_log->debug("firstEvtGDC1: {}\t firstEvtGDC2: {}", firstEvtGDC1, firstEvtGDC2);
-	}else{
-		_log->info("Events in file = {}", entriesThisFile_);
-		_log->debug("firstEvt: {}", firstEvtGDC1);
+	if(max_events_ < entriesThisFile_){
+		entriesThisFile_ = max_events_;
 	}
 
-	//Rewind back to the start of the file
-	if (file1) fseek(file1, 0, SEEK_SET);
-	if (file2) fseek(file2, 0, SEEK_SET);
+	_log->info("Events in files = {}", nevents);
+	for (auto stream : input_->streams()){
+		_log->debug("{}: {} events, first event: {}", stream->filenames().front(), stream->selectedEvents(), stream->firstEvent());
+	}
 
 	//TODO: Study what is this for here
 	eventReader_ = new EventReader(verbosity_);
-	fptr1_ = file1;
-	fptr2_ = file2;
-
-	if(twoFiles_ && gdc2first){
-		cfptr_ = fptr2_;
-		nextGdc2_ = true; //Changes in readNext()
-	}else{
-		cfptr_ = fptr1_;
-		nextGdc2_ = false;
-	}
 }
 
 bool next::RawDataInput::readNext()
@@ -205,51 +154,88 @@ bool next::RawDataInput::readNext()
 		return false;
 	}
 
-	//Try 2 times. Usually first time will be ok, but if next
-	//event is missing, skip it and go on with the next file
-	for(int files=0;files<2;files++){
-		//Choose file
-		if(twoFiles_){
-			if (nextGdc2_){
-				cfptr_ = fptr2_;
-			}else{
-				cfptr_ = fptr1_;
-			}
-			//Change file for next time
-			nextGdc2_ = !nextGdc2_;
-		}
-
-		int evt_number = loadNextEvent(cfptr_, &buffer_);
-		if (evt_number > 0){
-			event_ = (eventHeaderStruct*) buffer_;
+	if(!events_.empty()){
+		return readListedEvent(toSkip);
+	}
 
-			eventNo_++;
-			if(!toSkip){
-				for(int indexSipm=0;indexSipm<NUM_FEC_SIPM;indexSipm++){
-					sipmFec[indexSipm] = false;
-				}
-				bool result =  ReadDATEEvent();
-				if (result){
-					if(!eventError_ && discard_){
-						writeEvent();
-					}
-					freeWaveformMemory(&*pmtDgts_);
-					freeWaveformMemory(&*sipmDgts_);
-				}
-				free(buffer_);
-				return result;
-			}
-			//Unless error (missing event), we should read only one event at a time
-			break;
-		}
+	//Skipped events are not read from disk
+	int evt_number;
+	if(toSkip){
+		evt_number = input_->skipEvent();
+	}else if(streamSubEvents_){
+		evt_number = input_->loadNextEventHeader(&eventHeader_);
+	}else{
+		evt_number = input_->loadNextEvent(&buffer_);
+	}
+	if (evt_number < 0){
+		//No events left in any file
+		return false;
 	}
 
+	eventNo_++;
+	if(!toSkip){
+		return decodeEvent();
+	}
 	return eventNo_ < entriesThisFile_;
 }
 
-bool isEventSelected(eventHeaderStruct& event){
-  return event.eventType == PHYSICS_EVENT ||
-	  event.eventType == CALIBRATION_EVENT;
+// Reads the next event of the "events" list from the config, looking
+// for it in the index of each gdc file
+bool next::RawDataInput::readListedEvent(bool toSkip)
+{
+	int evt_number = events_[eventNo_];
+	eventNo_++;
+	if(toSkip){
+		return eventNo_ < entriesThisFile_;
+	}
+
+	if(!input_->seekEvent(evt_number)){
+		_logerr->warn("Event {} not found in input files", evt_number);
+		return eventNo_ < entriesThisFile_;
+	}
+
+	int loaded;
+	if(streamSubEvents_){
+		loaded = input_->loadNextEventHeader(&eventHeader_);
+	}else{
+		loaded = input_->loadNextEvent(&buffer_);
+	}
+	if (loaded < 0){
+		_logerr->error("Unable to read event {}", evt_number);
+		return false;
+	}
+	return decodeEvent();
+}
+
+// Decodes and writes the event in buffer_, then gives the buffer back
+// to the current file. With stream_subevents only eventHeader_ has been
+// loaded and the equipments are read while decoding.
+bool next::RawDataInput::decodeEvent()
+{
+	for(int indexSipm=0;indexSipm<NUM_FEC_SIPM;indexSipm++){
+		sipmFec[indexSipm] = false;
+	}
+	bool result;
+	if(streamSubEvents_){
+		event_ = &eventHeader_;
+		result = ReadDATEEventStreamed();
+	}else{
+		event_ = (eventHeaderStruct*) buffer_;
+		result = ReadDATEEvent();
+	}
+	if (result){
+		if(!eventError_ && discard_){
+			writeEvent();
+		}
+		freeWaveformMemory(&*pmtDgts_);
+		freeWaveformMemory(&*sipmDgts_);
+	}
+	if(streamSubEvents_){
+		input_->finishEvent();
+	}else{
+		input_->releaseEvent(buffer_);
+	}
+	return result;
 }
 
 bool next::RawDataInput::ReadDATEEvent()
@@ -259,38 +245,8 @@ bool next::RawDataInput::ReadDATEEvent()
 	unsigned char* position = nullptr;
 	unsigned char* end = nullptr;
 	int count = 0;
-	fFirstFT=0; /// Position in the buffer of the first FT
-	fFecId=0;   ///ID of the Front End Card
-	eventError_ = false;
-
-	//Num FEB
-	std::fill(sipmPosition, sipmPosition+NSIPMS,-1);
-	std::fill(sipmLastValues, sipmLastValues+NSIPMS,0);
-	std::fill(pmtPosition, pmtPosition+NPMTS,-1);
-
-	// Reset the output pointers.
-	pmtDgts_.reset(new DigitCollection);
-	sipmDgts_.reset(new DigitCollection);
-	trigOut_.clear();
-	triggerChans_.clear();
-
-	if (!event_) return false;
 
-	// now fill DATEEventHeader
-	headOut_.reset(new EventHeaderCollection);
-	(*headOut_).emplace_back();
-	auto myheader = (*headOut_).rbegin();
-
-	myheader->SetEventSize(event_->eventSize);
-	myheader->SetEventMagic(event_->eventMagic);
-	myheader->SetEventHeadSize(event_->eventHeadSize);
-	myheader->SetEventVersion(event_->eventVersion);
-	myheader->SetEventType(event_->eventType);
-	myheader->SetRunNb(event_->eventRunNb);
-	myheader->SetNbInRun(EVENT_ID_GET_NB_IN_RUN(event_->eventId));
-	_log->info("Event number: {}", myheader->NbInRun());
-	myheader->SetBurstNb( EVENT_ID_GET_BURST_NB(event_->eventId));
-	myheader->SetNbInBurst( EVENT_ID_GET_NB_IN_BURST(event_->eventId));
+	if (!ReadDATEEventHeader()) return false;
 
 	// check whether there are sub events
 	if (event_->eventSize <= event_->eventHeadSize) return false;
@@ -369,118 +325,331 @@ bool next::RawDataInput::ReadDATEEvent()
 			_log->debug("equipmentBasicElementSize: {}", equipment->equipmentBasicElementSize);
 		}
 
-		unsigned char *buffer = position;
-		unsigned int size = equipment->equipmentSize - sizeof(equipmentHeaderStruct);
+		ReadEquipment(equipment, position);
+
+		count = end - position;
+
+	}while(1);
+
+  return true;
+}
 
-		//////////Getting firmware version: foxtrot, golf, etc //////////////////
-		//
+// Same walk over sub-events and equipments as ReadDATEEvent, for an
+// event read by parts: only the headers and the payload of one
+// equipment are in memory at a time, so super-events of any size are
+// decoded with a buffer as big as the largest equipment.
+bool next::RawDataInput::ReadDATEEventStreamed()
+{
+	if (!ReadDATEEventHeader()) return false;
 
-		//Flip words
-		int16_t * buffer_cp = (int16_t*) buffer;
-		int16_t * payload_flip = (int16_t *) malloc(MEMSIZE);
-		int16_t * payload_flip_free = payload_flip;
-		flipWords(size, buffer_cp, payload_flip);
+	// check whether there are sub events
+	if (event_->eventSize <= event_->eventHeadSize) return false;
+
+	eventHeaderStruct subEvent;
+	equipmentHeaderStruct equipment;
+	uint64_t subPos = 0;
+	if (TEST_SYSTEM_ATTRIBUTE(event_->eventTypeAttribute, ATTR_SUPER_EVENT)){
+		subPos = event_->eventHeadSize;
+	}
+
+	while (subPos < event_->eventSize){
+		if (subPos == 0){
+			subEvent = *event_;   // no super event
+		}else if (!input_->readEventPart(subPos, sizeof(eventHeaderStruct), (unsigned char*) &subEvent)){
+			return false;
+		}
+
+		if ( verbosity_ >= 2 ) {
+			_log->debug("subEvent ldcId: {}", subEvent.eventLdcId);
+			_log->debug("subEvent eventSize: {}", subEvent.eventSize);
+		}
+
+		// check the magic word of the sub event
+		if (subEvent.eventMagic != EVENT_MAGIC_NUMBER) {
+			_logerr->error("NEXT1ELEventHandle::ReadDATEEventStreamed, wrong magic number in sub event!");
+			return false;
+		}
+
+		uint64_t subEnd = subPos + subEvent.eventSize;
+		uint64_t eqPos  = subPos + subEvent.eventHeadSize;
+		while (eqPos < subEnd){
+			if (!input_->readEventPart(eqPos, sizeof(equipmentHeaderStruct), (unsigned char*) &equipment)){
+				return false;
+			}
+			uint64_t position = eqPos + sizeof(equipmentHeaderStruct);
+			uint64_t end;
+			if (subEvent.eventVersion <= 0x00030001) {
+				end = position + equipment.equipmentSize;
+			} else {
+				end = eqPos + equipment.equipmentSize;
+			}
+			if (end <= eqPos){
+				_logerr->error("NEXT1ELEventHandle::ReadDATEEventStreamed, wrong equipment size {}", equipment.equipmentSize);
+				return false;
+			}
+			eqPos = end;
+
+			// continue with the next sub event if no data left in the payload
+			if (position >= end){
+				continue;
+			}
+
+			if ( verbosity_ >= 2 ) {
+				_log->debug("equipmentSize: {}", equipment.equipmentSize);
+				_log->debug("equipmentType: {}", equipment.equipmentType);
+				_log->debug("equipmentId: {}", equipment.equipmentId);
+				_log->debug("equipmentBasicElementSize: {}", equipment.equipmentBasicElementSize);
+			}
+
+			// flipWords may read a few bytes past the payload
+			size_t bytes = end - position;
+			if (equipmentBuffer_.size() < bytes + 16){
+				equipmentBuffer_.resize(bytes + 16);
+			}
+			if (!input_->readEventPart(position, bytes, equipmentBuffer_.data())){
+				return false;
+			}
+			ReadEquipment(&equipment, equipmentBuffer_.data());
+		}
+
+		subPos = (subPos == 0) ? event_->eventSize : subEnd;
+	}
+	return true;
+}
+
+// Resets the decoder state and fills the DATE header of event_
+bool next::RawDataInput::ReadDATEEventHeader()
+{
+	fFirstFT=0; /// Position in the buffer of the first FT
+	fFecId=0;   ///ID of the Front End Card
+	eventError_ = false;
+
+	//Num FEB
+	std::fill(sipmPosition, sipmPosition+NSIPMS,-1);
+	std::fill(sipmLastValues, sipmLastValues+NSIPMS,0);
+	std::fill(pmtPosition, pmtPosition+NPMTS,-1);
+
+	// Reset the output pointers.
+	pmtDgts_.reset(new DigitCollection);
+	sipmDgts_.reset(new DigitCollection);
+	trigOut_.clear();
+	triggerChans_.clear();
+
+	if (!event_) return false;
+
+	// now fill DATEEventHeader
+	headOut_.reset(new EventHeaderCollection);
+	(*headOut_).emplace_back();
+	auto myheader = (*headOut_).rbegin();
+
+	myheader->SetEventSize(event_->eventSize);
+	myheader->SetEventMagic(event_->eventMagic);
+	myheader->SetEventHeadSize(event_->eventHeadSize);
+	myheader->SetEventVersion(event_->eventVersion);
+	myheader->SetEventType(event_->eventType);
+	myheader->SetRunNb(event_->eventRunNb);
+	myheader->SetNbInRun(EVENT_ID_GET_NB_IN_RUN(event_->eventId));
+	_log->info("Event number: {}", myheader->NbInRun());
+	myheader->SetBurstNb( EVENT_ID_GET_BURST_NB(event_->eventId));
+	myheader->SetNbInBurst( EVENT_ID_GET_NB_IN_BURST(event_->eventId));
+
+	return true;
+}
+
+// Decodes the payload of one equipment
+void next::RawDataInput::ReadEquipment(equipmentHeaderStruct * equipment, unsigned char * buffer)
+{
+	auto myheader = (*headOut_).rbegin();
+	unsigned int size = equipment->equipmentSize - sizeof(equipmentHeaderStruct);
+
+	//////////Getting firmware version: foxtrot, golf, etc //////////////////
+	//
+
+	//Flip words into the buffer kept between equipments. size is in bytes
+	//but the readers may go up to size words into the payload, so the
+	//words after it are cleared instead of keeping a previous equipment
+	if (flipBuffer_.size() < size + FLIP_GUARD_WORDS){
+		flipBuffer_.clear();
+		flipBuffer_.resize(size + FLIP_GUARD_WORDS);
+	}
+	int16_t * buffer_cp = (int16_t*) buffer;
+	int16_t * payload_flip = flipBuffer_.data();
+	flipWords(size, buffer_cp, payload_flip);
+	std::fill(payload_flip + (size + 1) / 2, payload_flip + size + FLIP_GUARD_WORDS, 0);
 
 //		for(int i=0; i<100; i++){
 //			printf("payload[%d] = 0x%04x\n", i, payload_flip[i]);
 //		}
-		eventReader_->ReadCommonHeader(payload_flip);
-		fwVersion = eventReader_->FWVersion();
-		int FECtype = eventReader_->FecType();
-		if(eventReader_->TriggerCounter() != myheader->NbInRun()){
-			_logerr->error("EventID ({}) & TriggerCounter ({}) mismatch, possible loss of data in DATE in FEC {}", myheader->NbInRun(), eventReader_->TriggerCounter(), eventReader_->FecId());
-		}else{
-			if(verbosity_ >= 2){
-				_log->debug("EventID ({}) & TriggerCounter ({}) ok in FEC {}", myheader->NbInRun(), eventReader_->TriggerCounter(), eventReader_->FecId());
-			}
+	eventReader_->ReadCommonHeader(payload_flip);
+	fwVersion = eventReader_->FWVersion();
+	int FECtype = eventReader_->FecType();
+	if(eventReader_->TriggerCounter() != myheader->NbInRun()){
+		_logerr->error("EventID ({}) & TriggerCounter ({}) mismatch, possible loss of data in DATE in FEC {}", myheader->NbInRun(), eventReader_->TriggerCounter(), eventReader_->FecId());
+	}else{
+		if(verbosity_ >= 2){
+			_log->debug("EventID ({}) & TriggerCounter ({}) ok in FEC {}", myheader->NbInRun(), eventReader_->TriggerCounter(), eventReader_->FecId());
 		}
+	}
 
-		//FWVersion HOTEL
-		if (fwVersion == 8){
-			if (FECtype==0){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a PMT FEC");
-				}
+	//FWVersion HOTEL
+	if (fwVersion == 8){
+		if (FECtype==0){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a PMT FEC");
+			}
 //				for(unsigned int i=0; i<pmtDgts_->size(); i++){
 //					if((*pmtDgts_)[i].active()){
 //						std::cout << (*pmtDgts_)[i].nSamples() << " before read pmtDgts " << (*pmtDgts_)[i].chID() << "\t charge[0]: " << (*pmtDgts_)[i].waveform()[0] << std::endl;
 //					}
 //				}
-				ReadHotelPmt(payload_flip,size);
-				fwVersionPmt = fwVersion;
+			ReadHotelPmt(payload_flip,size);
+			fwVersionPmt = fwVersion;
 //				for(unsigned int i=0; i<pmtDgts_->size(); i++){
 //					if((*pmtDgts_)[i].active()){
 //						std::cout << (*pmtDgts_)[i].nSamples() << "after read pmtDgts " << (*pmtDgts_)[i].chID() << "\t charge[0]: " << (*pmtDgts_)[i].waveform()[0] << std::endl;
 //					}
 //				}
-			}else if (FECtype==2){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a Trigger FEC");
-				}
-				ReadHotelTrigger(payload_flip,size);
-			}else  if (FECtype==1){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a SIPM FEC");
-				}
-				ReadHotelSipm(payload_flip, size);
+		}else if (FECtype==2){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a Trigger FEC");
+			}
+			ReadHotelTrigger(payload_flip,size);
+		}else  if (FECtype==1){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a SIPM FEC");
 			}
+			ReadHotelSipm(payload_flip, size);
 		}
+	}
 
-		//FWVersion INDIA
-		if (fwVersion == 9){
-			if (FECtype==0){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a PMT FEC");
-				}
-				ReadIndiaJuliettPmt(payload_flip,size);
-				fwVersionPmt = fwVersion;
-			}else if (FECtype==2){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a Trigger FEC");
-				}
-				ReadIndiaTrigger(payload_flip,size);
-			}else  if (FECtype==1){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a SIPM FEC");
-				}
-				ReadHotelSipm(payload_flip, size);
+	//FWVersion INDIA
+	if (fwVersion == 9){
+		if (FECtype==0){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a PMT FEC");
+			}
+			ReadIndiaJuliettPmt(payload_flip,size);
+			fwVersionPmt = fwVersion;
+		}else if (FECtype==2){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a Trigger FEC");
 			}
+			ReadIndiaTrigger(payload_flip,size);
+		}else  if (FECtype==1){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a SIPM FEC");
+			}
+			ReadHotelSipm(payload_flip, size);
 		}
+	}
 
-		//FWVersion JULIETT
-		if (fwVersion == 10){
-			if (FECtype==0){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a PMT FEC");
-				}
-				if (read_pmts_){
-					ReadIndiaJuliettPmt(payload_flip,size);
-				}
-				fwVersionPmt = fwVersion;
-			}else if (FECtype==2){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a Trigger FEC");
-				}
-				ReadIndiaTrigger(payload_flip,size);
-			}else  if (FECtype==1){
-				if( verbosity_ >= 1 ){
-					_log->debug("This is a SIPM FEC");
-				}
-				if (read_sipms_){
-					ReadHotelSipm(payload_flip, size);
-				}
+	//FWVersion JULIETT
+	if (fwVersion == 10){
+		if (FECtype==0){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a PMT FEC");
+			}
+			if (read_pmts_){
+				ReadIndiaJuliettPmt(payload_flip,size);
+			}
+			fwVersionPmt = fwVersion;
+		}else if (FECtype==2){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a Trigger FEC");
+			}
+			ReadIndiaTrigger(payload_flip,size);
+		}else  if (FECtype==1){
+			if( verbosity_ >= 1 ){
+				_log->debug("This is a SIPM FEC");
+			}
+			if (read_sipms_){
+				ReadHotelSipm(payload_flip, size);
 			}
 		}
+	}
+}
 
-		count = end - position;
-		free(payload_flip_free);
+#if defined(__SSE2__) && defined(__GNUC__)
+#define SWAP_WORD_PAIRS_VECTOR
+// The vector versions swap the pairs of whole registers and return how
+// many pairs they did, the rest is left to the scalar loop
+__attribute__((target("avx2")))
+static unsigned int swapWordPairsAvx2(int16_t const * in, int16_t * out, unsigned int count){
+	const __m256i swap = _mm256_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13,
+	                                      2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13);
+	unsigned int i = 0;
+	for (; i + 8 <= count; i += 8){
+		__m256i words = _mm256_loadu_si256((__m256i const *) (in + 2*i));
+		_mm256_storeu_si256((__m256i *) (out + 2*i), _mm256_shuffle_epi8(words, swap));
+	}
+	return i;
+}
 
-	}while(1);
+__attribute__((target("ssse3")))
+static unsigned int swapWordPairsSsse3(int16_t const * in, int16_t * out, unsigned int count){
+	const __m128i swap = _mm_setr_epi8(2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13);
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4){
+		__m128i words = _mm_loadu_si128((__m128i const *) (in + 2*i));
+		_mm_storeu_si128((__m128i *) (out + 2*i), _mm_shuffle_epi8(words, swap));
+	}
+	return i;
+}
 
-  return true;
+static unsigned int swapWordPairsSse2(int16_t const * in, int16_t * out, unsigned int count){
+	unsigned int i = 0;
+	for (; i + 4 <= count; i += 4){
+		__m128i words = _mm_loadu_si128((__m128i const *) (in + 2*i));
+		words = _mm_or_si128(_mm_slli_epi32(words, 16), _mm_srli_epi32(words, 16));
+		_mm_storeu_si128((__m128i *) (out + 2*i), words);
+	}
+	return i;
+}
+#endif
+
+// Swaps the two 16-bit words of count 32-bit pairs. As in
+// unpackSamples12 the vector version is chosen at run time, SSE2 is
+// always there on x86-64.
+static void swapWordPairs(int16_t const * in, int16_t * out, unsigned int count){
+	unsigned int i = 0;
+#ifdef SWAP_WORD_PAIRS_VECTOR
+	static const bool avx2  = __builtin_cpu_supports("avx2");
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	if (avx2){
+		i = swapWordPairsAvx2(in, out, count);
+	}else if (ssse3){
+		i = swapWordPairsSsse3(in, out, count);
+	}else{
+		i = swapWordPairsSse2(in, out, count);
+	}
+#endif
+	for (; i < count; i++){
+		out[2*i]   = in[2*i+1];
+		out[2*i+1] = in[2*i];
+	}
 }
 
+// Same output as flipWordsScalar, the words between two skips are
+// swapped in one go. A pair is flipped while its position before the
+// skip is below (size+1)/2, so the first pair after a skip is always
+// written.
 void flipWords(unsigned int size, int16_t* in, int16_t* out){
+	unsigned int limit = (size + 1) / 2;
+	unsigned int pos_in = 0, pos_out = 0;
+	while (pos_in < limit){
+		if (pos_in > 0 && pos_in % 3996 == 0){
+			pos_in += 2;
+		}
+		unsigned int next_skip = (pos_in / 3996 + 1) * 3996;
+		unsigned int end = std::min(next_skip, std::max(limit, pos_in + 1));
+		unsigned int pairs = (end - pos_in + 1) / 2;
+		swapWordPairs(in + pos_in, out + pos_out, pairs);
+		pos_in  += 2 * pairs;
+		pos_out += 2 * pairs;
+	}
+}
+
+void flipWordsScalar(unsigned int size, int16_t* in, int16_t* out){
 	unsigned int pos_in = 0, pos_out = 0;
 	// This will stop just before FAFAFAFA, usually there are FFFFFFFF before
 	// With compression mode there could be some FAFAFAFA along the data
@@ -815,9 +984,6 @@ void next::RawDataInput::ReadHotelPmt(int16_t * buffer, unsigned int size){
 		fFirstFT = (singleBuff + trigDiff) % BufferSamples;
 	}
 
-	int nextFT = -1; //At start we don't know next FT value
-	int nextFThm = -1;
-
 	//Map febid -> channelmask
 	std::map<int, std::vector<int> > fec_chmask;
 	fec_chmask.emplace(fFecId, std::vector<int>());
@@ -825,21 +991,20 @@ void next::RawDataInput::ReadHotelPmt(int16_t * buffer, unsigned int size){
 	pmtsChannelMask(ChannelMask, fec_chmask[fFecId], fFecId, FWVersion);
 
 	//Create digits and waveforms for active channels
-	CreatePMTs(&*pmtDgts_, pmtPosition, &(fec_chmask[fFecId]), BufferSamples, ZeroSuppression);
+	CreatePMTs(&*pmtDgts_, pmtPosition, &(fec_chmask[fFecId]), BufferSamples, ZeroSuppression, FWVersion);
 	setActiveSensors(&(fec_chmask[fFecId]), &*pmtDgts_, pmtPosition);
 
 
-	for(unsigned int i=0; i<pmtDgts_->size(); i++){
-		int elecID = (*pmtDgts_)[i].chID();
-		int pos = pmtPosition[elecID];
-//		printf("index: %d, elecID: %d, position: %d\n", i, elecID, pos);
-	}
-
 	///Write pedestal
 	if(Baseline){
 		writePmtPedestals(eventReader_, &*pmtDgts_, &(fec_chmask[fFecId]), pmtPosition);
 	}
 
+	if(!ZeroSuppression){
+		decodePmtRaw(buffer, buffer + size / 2, fec_chmask[fFecId], pmtPosition, BufferSamples);
+		return;
+	}
+
 	//TODO maybe size of payload could be used here to stop, but the size is
 	//2x size per link and there are manu FFFF at the end, which are the actual
 	//stop condition...
@@ -884,20 +1049,6 @@ void next::RawDataInput::ReadHotelPmt(int16_t * buffer, unsigned int size){
 //			printf("FT: %d\n", FT);
 
 			decodeChargeHotelPmtZS(buffer, *pmtDgts_, fec_chmask[fFecId], pmtPosition, FT);
-
-		}else{
-			//If not ZS check next FT value, if not expected (0xffff) end of data
-			if(!ZeroSuppression){
-				computeNextFThm(&nextFT, &nextFThm, eventReader_);
-				if(FT != (nextFThm & 0x0FFFF)){
-					if( verbosity_ >= 2 ){
-						_log->debug("nextFThm != FT: 0x{:04x}, 0x{:04x}", (nextFThm&0x0ffff), FT);
-					}
-					break;
-				}
-			}
-			//decodeCharge(buffer, *pmtDgts_, fec_chmask[fFecId], pmtPosition, timeinmus);
-			decodeCharge(buffer, *pmtDgts_, fec_chmask[fFecId], pmtPosition, time);
 		}
 	}
 
@@ -909,9 +1060,6 @@ void next::RawDataInput::ReadHotelPmt(int16_t * buffer, unsigned int size){
 }
 
 void next::RawDataInput::ReadIndiaJuliettPmt(int16_t * buffer, unsigned int size){
-	int time = -1;
-	int current_bit = 31;
-
 	fFecId = eventReader_->FecId();
 	eventTime_ = eventReader_->TimeStamp();
 	triggerType_ = eventReader_->TriggerType();
@@ -931,13 +1079,14 @@ void next::RawDataInput::ReadIndiaJuliettPmt(int16_t * buffer, unsigned int size
 	int FWVersion = eventReader_->FWVersion();
 
 	if (ZeroSuppression){
-		if ((!huffmanPmt_.next[0]) && (!huffmanPmt_.next[1])){
-			auto myheader = (*headOut_).rbegin();
-			run_ = myheader->RunNb();
+		auto myheader = (*headOut_).rbegin();
+		run_ = myheader->RunNb();
+		if (huffmanPmt_.empty() || huffmanPmtRun_ != (int) run_){
 			getHuffmanFromDB(config_, &huffmanPmt_, run_, HuffmannSensor::pmt);
+			huffmanPmtRun_ = run_;
 			if( verbosity_ >= 1 ){
 				_log->debug("Huffman tree:\n");
-				print_huffman(_log, &huffmanPmt_, 1);
+				huffmanPmt_.print(_log);
 			}
 		}
 	}
@@ -957,8 +1106,6 @@ void next::RawDataInput::ReadIndiaJuliettPmt(int16_t * buffer, unsigned int size
 
 	///Reading the payload
 	fFirstFT = TriggerFT;
-	int nextFT = -1; //At start we don't know next FT value
-	int nextFThm = -1;
 
 	//Map febid -> channelmask
 	std::map<int, std::vector<int> > fec_chmask;
@@ -967,14 +1114,9 @@ void next::RawDataInput::ReadIndiaJuliettPmt(int16_t * buffer, unsigned int size
 	pmtsChannelMask(ChannelMask, fec_chmask[fFecId], fFecId, FWVersion);
 
 	//Create digits and waveforms for active channels
-	CreatePMTs(&*pmtDgts_, pmtPosition, &(fec_chmask[fFecId]), BufferSamples, ZeroSuppression);
+	CreatePMTs(&*pmtDgts_, pmtPosition, &(fec_chmask[fFecId]), BufferSamples, ZeroSuppression, FWVersion);
 	setActiveSensors(&(fec_chmask[fFecId]), &*pmtDgts_, pmtPosition);
 
-	for(unsigned int i=0; i<pmtDgts_->size(); i++){
-		int elecID = (*pmtDgts_)[i].chID();
-		int pos = pmtPosition[elecID];
-	}
-
 	///Write pedestal
 	if(Baseline){
 		writePmtPedestals(eventReader_, &*pmtDgts_, &(fec_chmask[fFecId]), pmtPosition);
@@ -983,36 +1125,17 @@ void next::RawDataInput::ReadIndiaJuliettPmt(int16_t * buffer, unsigned int size
 	//TODO maybe size of payload could be used here to stop, but the size is
 	//2x size per link and there are manu FFFF at the end, which are the actual
 	//stop condition...
-	while (true){
-		// timeinmus = timeinmus + CLOCK_TICK_;
-		time++;
-
-		if(ZeroSuppression){
-			// Skip FTm
-			if (time == 0) {
-				buffer++;
-			}
-			if (time == BufferSamples){
-				break;
-			}
-			decodeChargeIndiaPmtCompressed(buffer, &current_bit, *pmtDgts_, &huffmanPmt_, fec_chmask[fFecId], pmtPosition, time);
-		}else{
-			int FT = *buffer & 0x0FFFF;
-			buffer++;
-
-			//If not ZS check next FT value, if not expected (0xffff) end of data
-			if(!ZeroSuppression){
-				computeNextFThm(&nextFT, &nextFThm, eventReader_);
-				if(FT != (nextFThm & 0x0FFFF)){
-					if( verbosity_ >= 2 ){
-						_log->debug("nextFThm != FT: 0x{:04x}, 0x{:04x}", (nextFThm&0x0ffff), FT);
-					}
-					break;
-				}
-			}
-			decodeCharge(buffer, *pmtDgts_, fec_chmask[fFecId], pmtPosition, time);
-		}
+	if(ZeroSuppression){
+		// Compressed data starts after FTm and goes at most to the end
+		// of the payload
+		int16_t * stream = buffer + 1;
+		int16_t * end = buffer + size / 2;
+		size_t bits = end > stream ? (end - stream) * 16 : 0;
+		decodeIndiaPmtCompressed(stream, bits, *pmtDgts_, huffmanPmt_, fec_chmask[fFecId], pmtPosition, BufferSamples);
+		return;
 	}
+
+	decodePmtRaw(buffer, buffer + size / 2, fec_chmask[fFecId], pmtPosition, BufferSamples);
 }
 
 int next::RawDataInput::setDualChannels(next::EventReader * reader){
@@ -1151,6 +1274,17 @@ int computePmtElecID(int fecid, int channel, int fwversion){
 	return ElecID;
 }
 
+// Index of the PMT in the digit arrays (0 to NPMTS-1). Up to fw 9 the
+// electronic IDs already are positions, from fw 10 on they are sensor
+// IDs (100-723).
+int computePmtPosition(int fecid, int channel, int fwversion){
+	int ElecID = computePmtElecID(fecid, channel, fwversion);
+	if (fwversion >= 10){
+		return PmtIDtoPosition(ElecID);
+	}
+	return ElecID;
+}
+
 void next::RawDataInput::computeNextFThm(int * nextFT, int * nextFThm, next::EventReader * reader){
 	int PreTrgSamples = reader->PreTriggerSamples();
 	int BufferSamples = reader->BufferSamples();
@@ -1188,6 +1322,75 @@ void next::RawDataInput::computeNextFThm(int * nextFT, int * nextFThm, next::Eve
 	}
 }
 
+// RAW PMT data is one record per sample: the FT and the 12-bit charges
+// of the active channels, all records of the same size. The FTs are
+// checked first, the data ends at the first one out of sequence, then
+// the samples found are decoded in blocks, at the same time with
+// decoding threads.
+void next::RawDataInput::decodePmtRaw(int16_t * buffer, int16_t * end,
+	   	std::vector<int> &channelMaskVec, int* positions, int samples){
+	int nchannels = channelMaskVec.size();
+	int count = countPmtRawRecords(buffer, end, nchannels, samples, eventReader_);
+
+	std::vector<unsigned short *> waveforms(nchannels);
+	for(int chan=0; chan<nchannels; chan++){
+		waveforms[chan] = (pmtDgts_->begin() + positions[channelMaskVec[chan]])->waveform();
+	}
+	decodePmtRawSamples(decodePool_.get(), buffer, nchannels, count, waveforms.data());
+
+	if(verbosity_ >= 4){
+		for(int time=0; time<count; time++){
+			for(int chan=0; chan<nchannels; chan++){
+				_log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", channelMaskVec[chan], time, waveforms[chan][time]);
+			}
+		}
+	}
+}
+
+// Number of whole records before end whose FT follows the sequence
+// given by reader
+int next::RawDataInput::countPmtRawRecords(int16_t * buffer, int16_t * end, int nchannels, int samples, next::EventReader * reader){
+	// Channel 3 does not add new words
+	int stride = 1 + nchannels - nchannels/4;
+
+	int nextFT = -1; //At start we don't know next FT value
+	int nextFThm = -1;
+	int count = 0;
+	while(count < samples && buffer + (count + 1) * stride <= end){
+		int FT = buffer[count * stride] & 0x0FFFF;
+		computeNextFThm(&nextFT, &nextFThm, reader);
+		if(FT != (nextFThm & 0x0FFFF)){
+			if( verbosity_ >= 2 ){
+				_log->debug("nextFThm != FT: 0x{:04x}, 0x{:04x}", (nextFThm&0x0ffff), FT);
+			}
+			break;
+		}
+		count++;
+	}
+	return count;
+}
+
+void decodePmtRawSamples(next::ThreadPool * pool, int16_t const * buffer, int nchannels, int count, unsigned short ** waveforms){
+	int stride = 1 + nchannels - nchannels/4;
+	auto decode = [&](int from, int to){
+		uint16_t charges[PMTS_PER_FEC * 2];
+		for(int time=from; time<to; time++){
+			unpackSamples12(buffer + time * stride + 1, nchannels, charges);
+			for(int chan=0; chan<nchannels; chan++){
+				waveforms[chan][time] = charges[chan];
+			}
+		}
+	};
+	int tasks = pool ? std::min(pool->threads(), count / RAW_BLOCK_SAMPLES) : 0;
+	if(tasks > 1){
+		pool->run(tasks, [&](int task){
+			decode((long) count * task / tasks, (long) count * (task + 1) / tasks);
+		});
+	}else{
+		decode(0, count);
+	}
+}
+
 void next::RawDataInput::ReadHotelSipm(int16_t * buffer, unsigned int size){
     int16_t *payloadsipm_ptrA;
     int16_t *payloadsipm_ptrB;
@@ -1208,13 +1411,14 @@ void next::RawDataInput::ReadHotelSipm(int16_t * buffer, unsigned int size){
 
 	// Load Huffman table if data is compressed
 	if (CompressedData){
-		if ((!huffmanSipm_.next[0]) && (!huffmanSipm_.next[1])){
-			auto myheader = (*headOut_).rbegin();
-			run_ = myheader->RunNb();
+		auto myheader = (*headOut_).rbegin();
+		run_ = myheader->RunNb();
+		if (huffmanSipm_.empty() || huffmanSipmRun_ != (int) run_){
 			getHuffmanFromDB(config_, &huffmanSipm_, run_, HuffmannSensor::sipm);
+			huffmanSipmRun_ = run_;
 			if( verbosity_ >= 1 ){
 				_log->debug("Huffman tree:\n");
-				print_huffman(_log, &huffmanSipm_, 1);
+				huffmanSipm_.print(_log);
 			}
 		}
 	}
@@ -1239,19 +1443,6 @@ void next::RawDataInput::ReadHotelSipm(int16_t * buffer, unsigned int size){
 		}
 	}
 
-	//Copy pointers to each FEC payload
-	for(int i=0;i<NUM_FEC_SIPM;i++){
-		payloadSipmPtr[i] = (int16_t *) (payloadSipm+MEMSIZE*i);
-	}
-
-	//Copy data
-	for(unsigned int i=0; i<size; i++){
-		payloadSipmPtr[FecId][i] = buffer[i];
-	}
-
-	//Mark sipm as found
-	sipmFec[FecId] = true;
-
 	//Find partner
 	int channelA,channelB;
 	if(FecId % 2 == 0){
@@ -1261,123 +1452,147 @@ void next::RawDataInput::ReadHotelSipm(int16_t * buffer, unsigned int size){
 		channelA = FecId-1;
 		channelB = FecId;
 	}
+	int partner = (FecId == channelA) ? channelB : channelA;
+
+	//The first link of the pair is kept until its partner is read.
+	//The flip buffer is taken over instead of copied when the payload
+	//is in it.
+	if(!sipmFec[partner]){
+		std::vector<int16_t> &link = sipmLinks_[FecId];
+		int16_t *flip = flipBuffer_.data();
+		if(buffer >= flip && buffer + size <= flip + flipBuffer_.size()){
+			sipmLinkStart_[FecId] = buffer - flip;
+			link.swap(flipBuffer_);
+		}else{
+			link.assign(buffer, buffer + size);
+			sipmLinkStart_[FecId] = 0;
+		}
+		sipmFec[FecId] = true;
+		return;
+	}
 
-	//Check if we already have read 2i and 2i+1 channels
-	if(sipmFec[channelA] && sipmFec[channelB]){
-		_log->debug("A pair of SIPM FECs has been read, decoding...");
-		//Choose the correct pointers
-		payloadsipm_ptrA = payloadSipmPtr[channelA];
-		payloadsipm_ptrB = payloadSipmPtr[channelB];
-
-		//Rebuild payload from the two links
-		//TODO free && put correct size
-		//int16_t *payload_ptr = (int16_t*) malloc(size*2);
-		int16_t *payload_ptr = (int16_t*) malloc(MEMSIZE);
-		int16_t *mem_to_free = payload_ptr;
-		buildSipmData(size, payload_ptr, payloadsipm_ptrA, payloadsipm_ptrB);
-
-		//read data
-		int time = -1;
-		//std::vector<int> channelMaskVec;
+	//Mark sipm as found
+	sipmFec[FecId] = true;
 
-		//Map febid -> channelmask
-		std::map<int, std::vector<int> > feb_chmask;
+	_log->debug("A pair of SIPM FECs has been read, decoding...");
+	//Choose the correct pointers, the partner may be shorter
+	std::vector<int16_t> &staged = sipmLinks_[partner];
+	if(staged.size() < sipmLinkStart_[partner] + size){
+		staged.resize(sipmLinkStart_[partner] + size);
+	}
+	int16_t *partner_ptr = staged.data() + sipmLinkStart_[partner];
+	payloadsipm_ptrA = (FecId == channelA) ? buffer : partner_ptr;
+	payloadsipm_ptrB = (FecId == channelB) ? buffer : partner_ptr;
 
-		std::vector<int> activeSipmsInFeb;
-		activeSipmsInFeb.reserve(NUMBER_OF_FEBS);
+	//Walk the two links interleaved, 0xFFFF after them ends the data
+	next::SipmLinkCursor payload_ptr(payloadsipm_ptrA, payloadsipm_ptrB, size);
 
-		int previousFT = 0;
-		int nextFT = 0;
-		bool endOfData = false;
-		while (!endOfData){
-			time = time + 1;
-			for(unsigned int j=0; j<numberOfFEB; j++){
+	//read data
+	int time = -1;
+	//std::vector<int> channelMaskVec;
 
-				// for(int count=0; count<30; count++){
-				//     printf("[%d] 0x%04x\n", count, payload_ptr[count]);
-				// }
+	//Map febid -> channelmask
+	std::map<int, std::vector<int> > feb_chmask;
+
+	std::vector<int> activeSipmsInFeb;
+	activeSipmsInFeb.reserve(NUMBER_OF_FEBS);
+
+	int previousFT = 0;
+	int nextFT = 0;
+	bool endOfData = false;
+	compressedChannels_.clear();
+	compressedTimes_.clear();
+	compressedDeltas_.clear();
+	compressedKeep_.clear();
+	while (!endOfData){
+		time = time + 1;
+		for(unsigned int j=0; j<numberOfFEB; j++){
+
+			// for(int count=0; count<30; count++){
+			//     printf("[%d] 0x%04x\n", count, payload_ptr[count]);
+			// }
+
+			//Stop condition for while and for
+			if(*payload_ptr == 0xFFFFFFFF){
+				endOfData = true;
+				break;
+			}
 
-				//Stop condition for while and for
-				if(*payload_ptr == 0xFFFFFFFF){
-					endOfData = true;
-					break;
-				}
+			int FEBId = ((*payload_ptr) & 0x0FC00) >> 10;
+			int febInfo = (*payload_ptr) & 0x03FF;
+			int empty_feb = (febInfo & 0x0002) >> 1;
 
-				int FEBId = ((*payload_ptr) & 0x0FC00) >> 10;
-				int febInfo = (*payload_ptr) & 0x03FF;
-				int empty_feb = (febInfo & 0x0002) >> 1;
+			// If there is no data, stop processing this FEB
+			if (empty_feb){
+				payload_ptr++;
+				continue;
+			}
 
-				// If there is no data, stop processing this FEB
-				if (empty_feb){
-					payload_ptr++;
-					continue;
-				}
+			payload_ptr++;
+			if(verbosity_ >= 3){
+				_log->debug("Feb ID is 0x{:04x}", FEBId);
+				printf("j=%d, numberOfFEBs %d, previousFT %x, nextFT %x\n", j, numberOfFEB, previousFT, nextFT);
+			}
 
-				payload_ptr++;
-				if(verbosity_ >= 3){
-					_log->debug("Feb ID is 0x{:04x}", FEBId);
-					printf("j=%d, numberOfFEBs %d, previousFT %x, nextFT %x\n", j, numberOfFEB, previousFT, nextFT);
-				}
+			int FT = (*payload_ptr) & 0x0FFFF;
+			if (!ZeroSuppression){
+				if(time < 1){
+					previousFT = FT;
+				}else{
+					int BufferSamplesFT  = eventReader_->BufferSamples();
+					if (eventReader_->FWVersion() == 10){
+						BufferSamplesFT  = eventReader_->BufferSamples2();
+					}
 
-				int FT = (*payload_ptr) & 0x0FFFF;
-				if (!ZeroSuppression){
-					if(time < 1){
-						previousFT = FT;
+					//New FT only after reading all FEBs in the FEC
+					if (j == 0){
+						nextFT = ((previousFT + 1) & 0x0FFFF) % (BufferSamplesFT/40);
 					}else{
-						int BufferSamplesFT  = eventReader_->BufferSamples();
-						if (eventReader_->FWVersion() == 10){
-							BufferSamplesFT  = eventReader_->BufferSamples2();
-						}
-
-						//New FT only after reading all FEBs in the FEC
-						if (j == 0){
-							nextFT = ((previousFT + 1) & 0x0FFFF) % (BufferSamplesFT/40);
-						}else{
-							nextFT = previousFT;
-						}
-						if(nextFT != FT){
-							auto myheader = (*headOut_).rbegin();
-							//printf("j=%d, numberOfFEBs %d, previousFT %x, nextFT %x\n", j, numberOfFEB, previousFT, nextFT);
-							_logerr->error("SiPM Error! Event {}, FECs ({:x}, {:x}), FEB ID (0x{:x}, {}), expected FT was {:x}, current FT is {:x}, time {}", myheader->NbInRun(), channelA, channelB, FEBId, FEBId, nextFT, FT, time);
-							fileError_ = true;
-							eventError_ = true;
-							if(discard_){
-								return;
-							}
+						nextFT = previousFT;
+					}
+					if(nextFT != FT){
+						auto myheader = (*headOut_).rbegin();
+						//printf("j=%d, numberOfFEBs %d, previousFT %x, nextFT %x\n", j, numberOfFEB, previousFT, nextFT);
+						_logerr->error("SiPM Error! Event {}, FECs ({:x}, {:x}), FEB ID (0x{:x}, {}), expected FT was {:x}, current FT is {:x}, time {}", myheader->NbInRun(), channelA, channelB, FEBId, FEBId, nextFT, FT, time);
+						fileError_ = true;
+						eventError_ = true;
+						if(discard_){
+							return;
 						}
-						previousFT = nextFT;
 					}
+					previousFT = nextFT;
 				}
+			}
 
-				timeinmus = computeSipmTime(payload_ptr, eventReader_);
+			timeinmus = computeSipmTime(payload_ptr, eventReader_);
 
-				//If RAW mode, channel mask will appear the first time
-				//If ZS mode, channel mask will appear each time
-				if (time < 1 || ZeroSuppression){
-					feb_chmask.emplace(FEBId, std::vector<int>());
-					sipmChannelMask(payload_ptr, feb_chmask[FEBId], FEBId);
-					setActiveSensors(&(feb_chmask[FEBId]), &*sipmDgts_, sipmPosition);
-				}
+			//If RAW mode, channel mask will appear the first time
+			//If ZS mode, channel mask will appear each time
+			if (time < 1 || ZeroSuppression){
+				feb_chmask.emplace(FEBId, std::vector<int>());
+				sipmChannelMask(payload_ptr, feb_chmask[FEBId], FEBId);
+				setActiveSensors(&(feb_chmask[FEBId]), &*sipmDgts_, sipmPosition);
+			}
 
-				int offset = 0;
-				if(ZeroSuppression){
-					if(CompressedData){
-						int current_bit = 31;
-						decodeChargeIndiaSipmCompressed(payload_ptr, &current_bit, *sipmDgts_, &huffmanSipm_, feb_chmask[FEBId], sipmPosition, sipmLastValues, timeinmus);
-					}else{
-						decodeCharge(payload_ptr, *sipmDgts_, feb_chmask[FEBId], sipmPosition, timeinmus);
-					}
+			int offset = 0;
+			if(ZeroSuppression){
+				if(CompressedData){
+					readSipmCompressedFeb(payload_ptr, feb_chmask[FEBId], timeinmus);
 				}else{
-					if(CompressedData){
-						int current_bit = 31;
-						decodeChargeIndiaSipmCompressed(payload_ptr, &current_bit, *sipmDgts_, &huffmanSipm_, feb_chmask[FEBId], sipmPosition, sipmLastValues, time);
-					}else{
-						decodeCharge(payload_ptr, *sipmDgts_, feb_chmask[FEBId], sipmPosition, time);
-					}
+					decodeCharge(payload_ptr, *sipmDgts_, feb_chmask[FEBId], sipmPosition, timeinmus);
+				}
+			}else{
+				if(CompressedData){
+					readSipmCompressedFeb(payload_ptr, feb_chmask[FEBId], time);
+				}else{
+					decodeCharge(payload_ptr, *sipmDgts_, feb_chmask[FEBId], sipmPosition, time);
 				}
 			}
 		}
-		free(mem_to_free);
+	}
+
+	if(CompressedData){
+		reconstructSipmCompressed(*sipmDgts_, sipmPosition, sipmLastValues);
 	}
 }
 
@@ -1390,15 +1605,17 @@ void setActiveSensors(std::vector<int> * channelMaskVec, next::DigitCollection *
 
 int next::RawDataInput::pmtsChannelMask(int16_t chmask, std::vector<int> &channelMaskVec, int fecId, int fwversion){
 	int TotalNumberOfPMTs = 0;
-	int ElecID, pmtID;
+	int pmtID;
 
 	channelMaskVec.clear();
 	for (int t=0; t < 16; t++){
 		int bit = CheckBit(chmask, t);
 		if(bit>0){
-			ElecID = computePmtElecID(fecId, t, fwversion);
-			pmtID  = PmtIDtoPosition(ElecID);
-			// printf("channelmask: elecid: %d\tpmtid: %d\n", ElecID, pmtID);
+			pmtID = computePmtPosition(fecId, t, fwversion);
+			if (pmtID < 0 || pmtID >= NPMTS){
+				_logerr->error("PMT channel {} of FEC {} has no position (fw {})", t, fecId, fwversion);
+				continue;
+			}
 			channelMaskVec.push_back(pmtID);
 			TotalNumberOfPMTs++;
 		}
@@ -1413,7 +1630,8 @@ int next::RawDataInput::pmtsChannelMask(int16_t chmask, std::vector<int> &channe
 //There are 4 16-bit words with the channel mask for SiPMs
 //MSB ch63, LSB ch0
 //Data came after from 0 to 63
-int next::RawDataInput::sipmChannelMask(int16_t * &ptr, std::vector<int> &channelMaskVec, int febId){
+template <typename Ptr>
+int next::RawDataInput::sipmChannelMask(Ptr &ptr, std::vector<int> &channelMaskVec, int febId){
 	int TotalNumberOfSiPMs = 0;
 	int temp;
 
@@ -1442,7 +1660,8 @@ int next::RawDataInput::sipmChannelMask(int16_t * &ptr, std::vector<int> &channe
 	return TotalNumberOfSiPMs;
 }
 
-int next::RawDataInput::computeSipmTime(int16_t * &ptr, next::EventReader * reader){
+template <typename Ptr>
+int next::RawDataInput::computeSipmTime(Ptr &ptr, next::EventReader * reader){
 	int FTBit = reader->GetFTBit();
 	int TriggerFT = reader->TriggerFT();
 	int PreTrgSamples = reader->PreTriggerSamples();
@@ -1498,68 +1717,147 @@ void buildSipmData(unsigned int size, int16_t * ptr, int16_t * ptrA, int16_t * p
 	}
 }
 
-void next::RawDataInput::decodeChargeIndiaSipmCompressed(int16_t* &ptr,
-	   	int * current_bit, next::DigitCollection &digits, Huffman * huffman,
-	   	std::vector<int> &channelMaskVec, int* positions, int* last_values, int time){
-	int data = 0;
-	// Use in SiPM after decoding, to leave the ptr in the starting position of the next FEB
-	int words_to_add = 0;
-
+// First step of the compressed SiPMs, the symbols are kept until the
+// whole FEC pair is read and reconstructSipmCompressed builds the
+// waveforms
+template <typename Ptr>
+void next::RawDataInput::decodeChargeIndiaSipmCompressed(next::BitReader<Ptr> &reader,
+	   	HuffmanTable const & huffman, std::vector<int> &channelMaskVec, int time){
+	int control_code = 123456;
 	for(int chan=0; chan<channelMaskVec.size(); chan++){
-		// It is important to keep datatypes, memory allocation changes with them
-		int16_t * charge_ptr = (int16_t *) &data;
+		int value;
+		bool escape = decode_compressed_symbol(reader, control_code, huffman, &value);
+		compressedChannels_.push_back(channelMaskVec[chan]);
+		compressedTimes_.push_back(time);
+		compressedDeltas_.push_back(value);
+		compressedKeep_.push_back(escape ? 0 : -1);
+	}
 
-		if(*current_bit < 16){
-			ptr++;
-			*current_bit += 16;
-		}
+	// The next FEB starts in a new word. A FEB without channels still
+	// takes one word.
+	if (reader.consumed() == 0){
+		reader.consume(16);
+	}
+	reader.align();
+}
 
-		memcpy(charge_ptr+1, ptr  , 2);
-		memcpy(charge_ptr  , ptr+1, 2);
+// The symbols of a FEB are decoded here while walking the records, the
+// end of one FEB is only known once its codes are resolved
+void next::RawDataInput::readSipmCompressedFeb(next::SipmLinkCursor &ptr, std::vector<int> &channelMaskVec, int time){
+	next::BitReader<next::SipmLinkCursor> reader(ptr);
+	decodeChargeIndiaSipmCompressed(reader, huffmanSipm_, channelMaskVec, time);
+	ptr = reader.word();
+}
 
-		// Get previous value
-		auto dgt = digits.begin() + positions[channelMaskVec[chan]];
-		int previous = 0;
-		previous = last_values[channelMaskVec[chan]];
+// Second step of the compressed SiPMs: the symbols of each channel, in
+// the order they were read, are added up from its last value
+void next::RawDataInput::reconstructSipmCompressed(next::DigitCollection &digits, int* positions, int* last_values){
+	size_t nsymbols = compressedChannels_.size();
 
-		int control_code = 123456;
-		int wfvalue = decode_compressed_value(previous, data, control_code, current_bit, huffman);
-		last_values[channelMaskVec[chan]] = wfvalue;
+	// Symbols sorted by channel, keeping their order
+	std::vector<int> first(NSIPMS + 1, 0);
+	for(size_t i=0; i<nsymbols; i++){
+		first[compressedChannels_[i] + 1]++;
+	}
+	std::partial_sum(first.begin(), first.end(), first.begin());
+	std::vector<int> order(nsymbols);
+	std::vector<int> next(first.begin(), first.end() - 1);
+	for(size_t i=0; i<nsymbols; i++){
+		order[next[compressedChannels_[i]]++] = i;
+	}
 
-		if(verbosity_ >= 4){
-			 _log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", channelMaskVec[chan], time, wfvalue);
+	compressedValues_.resize(nsymbols);
+	std::vector<int> deltas, keep, values;
+	for(int channel=0; channel<NSIPMS; channel++){
+		int count = first[channel+1] - first[channel];
+		if(!count){
+			continue;
 		}
+		deltas.resize(count);
+		keep.resize(count);
+		values.resize(count);
+		for(int k=0; k<count; k++){
+			int i = order[first[channel] + k];
+			deltas[k] = compressedDeltas_[i];
+			keep[k]   = compressedKeep_[i];
+		}
+		reconstructDeltas(deltas.data(), keep.data(), count, last_values[channel], values.data());
 
-		//Save data in Digits
-		dgt->waveform()[time] = wfvalue;
+		auto dgt = digits.begin() + positions[channel];
+		for(int k=0; k<count; k++){
+			int i = order[first[channel] + k];
+			compressedValues_[i] = values[k];
+			dgt->waveform()[compressedTimes_[i]] = values[k];
+		}
+		last_values[channel] = values[count-1];
 	}
 
-	if (*current_bit < 15){
-		ptr += 2; // We have consumed part of the second word
-	}else{
-		ptr++; // We are in the first word
+	if(verbosity_ >= 4){
+		for(size_t i=0; i<nsymbols; i++){
+			_log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", compressedChannels_[i], compressedTimes_[i], compressedValues_[i]);
+		}
 	}
 }
 
+// Compressed PMT waveforms of all the samples in two steps: the symbols
+// are read into an array per channel, with the escaped values marked,
+// then each waveform is the prefix sum of its array
+void next::RawDataInput::decodeIndiaPmtCompressed(int16_t * stream, size_t bits,
+	   	next::DigitCollection &digits, HuffmanTable const & huffman,
+	   	std::vector<int> &channelMaskVec, int* positions, int samples){
+	int nchannels = channelMaskVec.size();
+	size_t nsymbols = (size_t) nchannels * samples;
+	compressedDeltas_.resize(nsymbols);
+	compressedKeep_.resize(nsymbols);
+	compressedValues_.resize(nsymbols);
+
+	// Long streams are split between the decoding threads
+	int segments = 0;
+	if(decodePool_){
+		segments = std::min((size_t) decodePool_->threads(), bits / SPECULATIVE_SEGMENT_BITS);
+	}
+	if(segments > 1){
+		int resynchronised = decodeCompressedSymbolsParallel(*decodePool_, stream, bits, huffman,
+				nchannels, samples, segments, compressedDeltas_.data(), compressedKeep_.data());
+		if(verbosity_ >= 2){
+			_log->debug("Compressed PMTs decoded in {} segments, {} decoded again", segments, resynchronised);
+		}
+	}else{
+		next::BitReader<int16_t*> reader(stream);
+		decodeCompressedSymbols(reader, huffman, nchannels, samples, compressedDeltas_.data(), compressedKeep_.data());
+	}
 
+	for(int chan=0; chan<nchannels; chan++){
+		size_t row = (size_t) chan * samples;
+		int * values = compressedValues_.data() + row;
+		reconstructDeltas(compressedDeltas_.data() + row, compressedKeep_.data() + row, samples, 0, values);
 
-void next::RawDataInput::decodeChargeIndiaPmtCompressed(int16_t* &ptr,
-	   	int * current_bit, next::DigitCollection &digits, Huffman * huffman,
-	   	std::vector<int> &channelMaskVec, int* positions, int time){
-	int data = 0;
-
-	for(int chan=0; chan<channelMaskVec.size(); chan++){
-		// It is important to keep datatypes, memory allocation changes with them
-		int16_t * charge_ptr = (int16_t *) &data;
-
-		if(*current_bit < 16){
-			ptr++;
-			*current_bit += 16;
+		//Save data in Digits
+		auto dgt = digits.begin() + positions[channelMaskVec[chan]];
+		for(int time=0; time<samples; time++){
+			dgt->waveform()[time] = values[time];
 		}
+	}
 
-		memcpy(charge_ptr+1, ptr  , 2);
-		memcpy(charge_ptr  , ptr+1, 2);
+	if(verbosity_ >= 4){
+		for(int time=0; time<samples; time++){
+			for(int chan=0; chan<nchannels; chan++){
+				size_t i = (size_t) chan * samples + time;
+				// The previous value is the one stored, 16 bits
+				int wfvalue = compressedDeltas_[i];
+				if(compressedKeep_[i] && time){
+					wfvalue += (unsigned short) compressedValues_[i-1];
+				}
+				_log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", channelMaskVec[chan], time, wfvalue);
+			}
+		}
+	}
+}
 
+void next::RawDataInput::decodeChargeIndiaPmtCompressed(next::BitReader<int16_t*> &reader,
+	   	next::DigitCollection &digits, HuffmanTable const & huffman,
+	   	std::vector<int> &channelMaskVec, int* positions, int time){
+	for(int chan=0; chan<channelMaskVec.size(); chan++){
 		// Get previous value
 		auto dgt = digits.begin() + positions[channelMaskVec[chan]];
 		int previous = 0;
@@ -1568,7 +1866,7 @@ void next::RawDataInput::decodeChargeIndiaPmtCompressed(int16_t* &ptr,
 		}
 
 		int control_code = 123456;
-		int wfvalue = decode_compressed_value(previous, data, control_code, current_bit, huffman);
+		int wfvalue = decode_compressed_value(previous, reader, control_code, huffman);
 
 		if(verbosity_ >= 4){
 			 _log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", channelMaskVec[chan], time, wfvalue);
@@ -1579,57 +1877,240 @@ void next::RawDataInput::decodeChargeIndiaPmtCompressed(int16_t* &ptr,
 	}
 }
 
-void next::RawDataInput::decodeCharge(int16_t* &ptr, next::DigitCollection &digits, std::vector<int> &channelMaskVec, int* positions, int time){
-	//Raw Mode
-	int Charge = 0;
-	int16_t * payloadCharge_ptr = ptr;
-
-	//We have 64 SiPM per FEB
-	for(int chan=0; chan<channelMaskVec.size(); chan++){
-		// It is important to keep datatypes, memory allocation changes with them
-		int16_t * charge_ptr = (int16_t *) &Charge;
-
-		memcpy(charge_ptr+1, payloadCharge_ptr, 2);
-		memcpy(charge_ptr, payloadCharge_ptr+1, 2);
+// current_bit is the next bit of the 32 starting at ptr, from 31
+void next::RawDataInput::decodeChargeIndiaPmtCompressed(int16_t* &ptr,
+	   	int * current_bit, next::DigitCollection &digits, HuffmanTable const & huffman,
+	   	std::vector<int> &channelMaskVec, int* positions, int time){
+	next::BitReader<int16_t*> reader(ptr, 31 - *current_bit);
+	decodeChargeIndiaPmtCompressed(reader, digits, huffman, channelMaskVec, positions, time);
+	ptr = reader.word();
+	*current_bit = 31 - reader.bitInWord();
+}
 
-		switch(chan % 4){
+// 3 words (0123,4567,89AB) give 4 charges (012,345,678,9AB)
+// (012)(3 45)(67 8)(9AB)
+void unpackSamples12Scalar(int16_t const * in, int count, uint16_t * out){
+	for(int i=0; i<count; i++){
+		uint16_t const * words = (uint16_t const *) in + i/4*3;
+		switch(i % 4){
 			case 0:
-				Charge = Charge >> 20;
-				Charge = Charge & 0x0fff;
+				out[i] = words[0] >> 4;
 				break;
 			case 1:
-				Charge = Charge >> 8;
-				Charge = Charge & 0x0fff;
+				out[i] = ((words[0] & 0x000f) << 8) | (words[1] >> 8);
 				break;
 			case 2:
-				Charge = Charge >> 12;
-				Charge = Charge & 0x0fff;
+				out[i] = ((words[1] & 0x00ff) << 4) | (words[2] >> 12);
 				break;
 			case 3:
-				Charge = Charge & 0x0fff;
+				out[i] = words[2] & 0x0fff;
 				break;
 		}
-		if((chan % 4)==1){
-			payloadCharge_ptr+=1;
+	}
+}
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#define UNPACK_SAMPLES12_SSSE3
+// 8 charges (6 words) per iteration. The bytes of each charge are moved
+// to its own 16-bit lane, then even lanes are shifted and odd lanes are
+// masked. Loads 8 words, so it stops while there is a charge after the
+// block: the scalar decoder read those words too.
+__attribute__((target("ssse3")))
+static int unpackSamples12Ssse3(int16_t const * in, int count, uint16_t * out){
+	const __m128i shuffle = _mm_setr_epi8(0,1, 3,0, 5,2, 4,5, 6,7, 9,6, 11,8, 10,11);
+	const __m128i even = _mm_setr_epi16(-1,0, -1,0, -1,0, -1,0);
+	const __m128i mask = _mm_set1_epi16(0x0fff);
+	int i = 0;
+	for (; i + 8 < count; i += 8){
+		__m128i words = _mm_loadu_si128((__m128i const *) (in + i/4*3));
+		__m128i lanes = _mm_shuffle_epi8(words, shuffle);
+		__m128i charges = _mm_or_si128(_mm_and_si128(even, _mm_srli_epi16(lanes, 4)),
+		                               _mm_andnot_si128(even, _mm_and_si128(lanes, mask)));
+		_mm_storeu_si128((__m128i *) (out + i), charges);
+	}
+	return i;
+}
+#endif
+
+// The SSSE3 version is chosen at run time, the rest (and machines
+// without it) go through unpackSamples12Scalar
+void unpackSamples12(int16_t const * in, int count, uint16_t * out){
+	int i = 0;
+#ifdef UNPACK_SAMPLES12_SSSE3
+	static const bool ssse3 = __builtin_cpu_supports("ssse3");
+	if (ssse3){
+		i = unpackSamples12Ssse3(in, count, out);
+	}
+#endif
+	unpackSamples12Scalar(in + i/4*3, count - i, out + i);
+}
+
+void reconstructDeltasScalar(int const * deltas, int const * keep, int count, int carry, int * out){
+	for(int i=0; i<count; i++){
+		carry = deltas[i] + (keep[i] & carry);
+		out[i] = carry;
+	}
+}
+
+// Segmented prefix sum, 4 values per iteration: each lane is combined
+// with the one 1 and then 2 lanes before (value += keep & value before,
+// keep &= keep before), so it ends up with the sum since the last
+// escape in the block and whether there was none. Then the previous
+// value is added to the lanes without escapes.
+void reconstructDeltas(int const * deltas, int const * keep, int count, int carry, int * out){
+	int i = 0;
+#if defined(__SSE2__)
+	const __m128i one  = _mm_setr_epi32(-1, 0, 0, 0);
+	const __m128i two  = _mm_setr_epi32(-1, -1, 0, 0);
+	__m128i previous = _mm_set1_epi32(carry);
+	for (; i + 4 <= count; i += 4){
+		__m128i values = _mm_loadu_si128((__m128i const *) (deltas + i));
+		__m128i masks  = _mm_loadu_si128((__m128i const *) (keep + i));
+		values = _mm_add_epi32(values, _mm_and_si128(masks, _mm_slli_si128(values, 4)));
+		masks  = _mm_and_si128(masks, _mm_or_si128(_mm_slli_si128(masks, 4), one));
+		values = _mm_add_epi32(values, _mm_and_si128(masks, _mm_slli_si128(values, 8)));
+		masks  = _mm_and_si128(masks, _mm_or_si128(_mm_slli_si128(masks, 8), two));
+		values = _mm_add_epi32(values, _mm_and_si128(masks, previous));
+		_mm_storeu_si128((__m128i *) (out + i), values);
+		previous = _mm_shuffle_epi32(values, 0xFF);
+	}
+	if (i > 0){
+		carry = out[i-1];
+	}
+#endif
+	reconstructDeltasScalar(deltas + i, keep + i, count - i, carry, out + i);
+}
+
+// Symbol i of the stream goes to channel i % channels, time i / channels
+static inline size_t symbolIndex(int i, int channels, int samples){
+	return (size_t) (i % channels) * samples + i / channels;
+}
+
+void decodeCompressedSymbols(next::BitReader<int16_t*> &reader, HuffmanTable const & huffman,
+	   	int channels, int samples, int * deltas, int * keep){
+	int control_code = 123456;
+	int count = channels * samples;
+	for(int i=0; i<count; i++){
+		size_t index = symbolIndex(i, channels, samples);
+		bool escape = decode_compressed_symbol(reader, control_code, huffman, &deltas[index]);
+		keep[index] = escape ? 0 : -1;
+	}
+}
+
+// Symbols decoded from a bit that may not be the start of one
+struct SpeculativeSegment {
+	std::vector<size_t> starts; // First bit of each symbol
+	std::vector<int> values;
+	std::vector<char> escapes;
+	size_t end;                 // Bit after the last one
+};
+
+// Each segment of the stream is decoded from its first bit, as if a
+// symbol started there, up to the start of the next one. A wrong start
+// gives wrong symbols for a while, but Huffman codes resynchronise: once
+// a symbol ends where a real one ends, the rest are right. Going through
+// the segments in order, the one before tells where the first real
+// symbol of each segment starts, and its symbols are kept from there.
+// When that bit is not one of the starts found, the segment is decoded
+// again serially from it.
+// Returns the number of segments decoded again.
+int decodeCompressedSymbolsParallel(next::ThreadPool &pool, int16_t * start, size_t bits,
+	   	HuffmanTable const & huffman, int channels, int samples, int segments,
+	   	int * deltas, int * keep){
+	int control_code = 123456;
+	int count = channels * samples;
+	std::vector<SpeculativeSegment> speculative(segments);
+
+	pool.run(segments, [&](int k){
+		size_t from = bits * k / segments;
+		size_t to   = bits * (k + 1) / segments;
+		size_t base = from / 16 * 16;
+		SpeculativeSegment & segment = speculative[k];
+		next::BitReader<int16_t*> reader(start + from / 16, from % 16);
+		size_t position = from;
+		// Every code takes a bit but an empty table, hence the count
+		while (position < to && (int) segment.starts.size() < count){
+			int value;
+			segment.starts.push_back(position);
+			segment.escapes.push_back(decode_compressed_symbol(reader, control_code, huffman, &value));
+			segment.values.push_back(value);
+			position = base + reader.consumed();
 		}
-		if((chan % 4)==3){
-			payloadCharge_ptr+=2;
+		segment.end = position;
+	});
+
+	int done = 0;
+	size_t position = 0;
+	int resynchronised = 0;
+	for(int k=0; k<segments && done<count; k++){
+		SpeculativeSegment const & segment = speculative[k];
+		auto first = std::lower_bound(segment.starts.begin(), segment.starts.end(), position);
+		if(first != segment.starts.end() && *first == position){
+			size_t j = first - segment.starts.begin();
+			for(; j<segment.starts.size() && done<count; j++, done++){
+				size_t index = symbolIndex(done, channels, samples);
+				deltas[index] = segment.values[j];
+				keep[index] = segment.escapes[j] ? 0 : -1;
+			}
+			position = j < segment.starts.size() ? segment.starts[j] : segment.end;
+		}else{
+			resynchronised++;
 		}
 
-		if(verbosity_ >= 4){
-			_log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", channelMaskVec[chan], time, Charge);
+		// Up to the next segment, or to the end for the last one
+		size_t to = k + 1 < segments ? bits * (k + 1) / segments : (size_t) -1;
+		if(done < count && position < to){
+			size_t base = position / 16 * 16;
+			next::BitReader<int16_t*> reader(start + position / 16, position % 16);
+			for(; done<count && position<to; done++){
+				size_t index = symbolIndex(done, channels, samples);
+				bool escape = decode_compressed_symbol(reader, control_code, huffman, &deltas[index]);
+				keep[index] = escape ? 0 : -1;
+				position = base + reader.consumed();
+			}
 		}
+	}
+	return resynchronised;
+}
 
-		//Save data in Digits
-		auto dgt = digits.begin() + positions[channelMaskVec[chan]];
-		dgt->waveform()[time] = Charge;
+//The packed words of a FEB, the cursor ones are copied to scratch
+static inline int16_t const * packedWords(int16_t * ptr, int, int16_t *){
+	return ptr;
+}
 
+static inline int16_t const * packedWords(next::SipmLinkCursor const &ptr, int count, int16_t * scratch){
+	for(int i=0; i<count; i++){
+		scratch[i] = ptr[i];
+	}
+	return scratch;
+}
+
+template <typename Ptr>
+void next::RawDataInput::decodeCharge(Ptr &ptr, next::DigitCollection &digits, std::vector<int> &channelMaskVec, int* positions, int time){
+	//Raw Mode
+	//We have 64 SiPM per FEB, unpacked together
+	const int chunk = SIPMS_PER_FEB;
+	int16_t scratch[chunk/4*3 + 1];
+	uint16_t charges[chunk];
+
+	int nchannels = channelMaskVec.size();
+	for(int first=0; first<nchannels; first+=chunk){
+		int count = std::min(chunk, nchannels - first);
 		// Channel 3 does not add new words
-		// 3 words (0123,4567,89AB) give 4 charges (012,345,678,9AB)
-		// (012)(3 45)(67 8)(9AB)
-		if((chan % 4) != 3){
-			ptr++;
+		int nwords = count - count/4;
+		unpackSamples12(packedWords(ptr, nwords + 1, scratch), count, charges);
+
+		for(int i=0; i<count; i++){
+			int chan = first + i;
+			if(verbosity_ >= 4){
+				_log->debug("ElecID is {}\t Time is {}\t Charge is 0x{:04x}", channelMaskVec[chan], time, charges[i]);
+			}
+
+			//Save data in Digits
+			auto dgt = digits.begin() + positions[channelMaskVec[chan]];
+			dgt->waveform()[time] = charges[i];
 		}
+		ptr += nwords;
 	}
 }
 
@@ -1761,10 +2242,14 @@ void createWaveforms(next::DigitCollection * sensors, int bufferSamples){
 	}
 }
 
-void CreatePMTs(next::DigitCollection * pmts, int * positions, std::vector<int> * elecIDs, int bufferSamples, bool zs){
+void CreatePMTs(next::DigitCollection * pmts, int * positions, std::vector<int> * elecIDs, int bufferSamples, bool zs, int fwversion){
 	///Creating one class Digit per each MT
 	for (unsigned int i=0; i < elecIDs->size(); i++){
-		int elecID = PositiontoPmtID((*elecIDs)[i]);
+		//Sensor IDs only from fw 10 on, see computePmtPosition
+		int elecID = (*elecIDs)[i];
+		if (fwversion >= 10){
+			elecID = PositiontoPmtID(elecID);
+		}
 		// printf("elecID: %d, position: %d\n", elecID, (*elecIDs)[i]);
 		if (zs){
 			pmts->emplace_back(elecID, next::digitType::RAWZERO, next::chanType::PMT);
@@ -1777,18 +2262,6 @@ void CreatePMTs(next::DigitCollection * pmts, int * positions, std::vector<int>
 	}
 }
 
-unsigned int next::RawDataInput::readHeaderSize(std::FILE* fptr) const
-{
-	unsigned char buf[4];
-	eventHeadSizeType size;
-	fseek(fptr, 8, SEEK_CUR);
-	fread(buf, 1, 4, fptr);
-	size = *buf;
-	fseek(fptr, -12, SEEK_CUR);
-	return (unsigned int)size;
-}
-
-
 void next::RawDataInput::writeEvent(){
 	DigitCollection extPmt;
 	DigitCollection pmts;
@@ -1920,3 +2393,14 @@ void freeWaveformMemory(next::DigitCollection * sensors){
 		free((*sensors)[i].waveform());
 	}
 }
+
+//SiPM decoders read the pair of links through SipmLinkCursor, the rest
+//of the callers use plain pointers
+template int next::RawDataInput::sipmChannelMask(int16_t* &, std::vector<int> &, int);
+template int next::RawDataInput::sipmChannelMask(next::SipmLinkCursor &, std::vector<int> &, int);
+template int next::RawDataInput::computeSipmTime(int16_t* &, next::EventReader *);
+template int next::RawDataInput::computeSipmTime(next::SipmLinkCursor &, next::EventReader *);
+template void next::RawDataInput::decodeCharge(int16_t* &, next::DigitCollection &, std::vector<int> &, int *, int);
+template void next::RawDataInput::decodeCharge(next::SipmLinkCursor &, next::DigitCollection &, std::vector<int> &, int *, int);
+template void next::RawDataInput::decodeChargeIndiaSipmCompressed(next::BitReader<int16_t*> &, HuffmanTable const &, std::vector<int> &, int);
+template void next::RawDataInput::decodeChargeIndiaSipmCompressed(next::BitReader<next::SipmLinkCursor> &, HuffmanTable const &, std::vector<int> &, int);
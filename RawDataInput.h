@@ -24,6 +24,22 @@
 #include "detail/EventReader.h"
 #endif
 
+#ifndef _DATEMERGER
+#include "detail/DATEMerger.h"
+#endif
+
+#ifndef _SIPMLINKCURSOR
+#include "detail/SipmLinkCursor.h"
+#endif
+
+#ifndef _BITREADER
+#include "detail/BitReader.h"
+#endif
+
+#ifndef _THREADPOOL
+#include "detail/ThreadPool.h"
+#endif
+
 #include "detail/event.h"
 
 #include <stdint.h>
@@ -39,6 +55,9 @@
 #define SIPMS_PER_FEB 64
 #define NUMBER_OF_FEBS 28
 #define MEMSIZE 8500000
+#define SPECULATIVE_SEGMENT_BITS 65536 // least bits decoded by each thread
+#define RAW_BLOCK_SAMPLES 4096 // least RAW PMT samples decoded by each thread
+#define FLIP_GUARD_WORDS 16 // flipWords writes up to 2 words past size bytes
 
 #define NSIPMS 3584
 #define NPMTS 168
@@ -53,15 +72,16 @@ public:
 
   /// Open specified file.
   void readFile(std::string const & filename);
-  std::FILE* openDATEFile(std::string const & filename);
-  void countEvents(std::FILE* file, int * events, int * firstEvt);
-  int loadNextEvent(std::FILE* file, unsigned char ** buffer);
+  next::DATEStream* openDATEStream(std::vector<std::string> const & filenames);
 
   /// Read an event.
   bool readNext();
 
   ///Function to read DATE information
   bool ReadDATEEvent();
+  bool ReadDATEEventStreamed();
+  bool ReadDATEEventHeader();
+  void ReadEquipment(equipmentHeaderStruct * equipment, unsigned char * buffer);
   void ReadHotelSipm(int16_t * buffer, unsigned int size);
   void ReadHotelPmt(int16_t * buffer, unsigned int size);
   void ReadIndiaJuliettPmt(int16_t * buffer, unsigned int size);
@@ -71,42 +91,56 @@ public:
   ///Fill PMT classes
   int setDualChannels(next::EventReader * reader);
   void computeNextFThm(int * nextFT, int * nextFThm, next::EventReader * reader);
+  void decodePmtRaw(int16_t * buffer, int16_t * end, std::vector<int> &channelMaskVec, int *positions, int samples);
+  int countPmtRawRecords(int16_t * buffer, int16_t * end, int nchannels, int samples, next::EventReader * reader);
 
-  void decodeCharge(int16_t* &buffer, next::DigitCollection &digits, std::vector<int> &channelMaskVec, int *positions, int time);
+  ///The decoders used for SiPMs take an int16_t* or a SipmLinkCursor
+  template <typename Ptr>
+  void decodeCharge(Ptr &buffer, next::DigitCollection &digits, std::vector<int> &channelMaskVec, int *positions, int time);
   void decodeChargeHotelPmtZS(int16_t* &buffer, next::DigitCollection &digits, std::vector<int> &channelMaskVec, int *positions, int timeinmus);
   void decodeChargeIndiaPmtZS(int16_t* &buffer, next::DigitCollection &digits, std::vector<int> &channelMaskVec, int *positions, int timeinmus);
-  void decodeChargeIndiaPmtCompressed(int16_t* &buffer, int *current_bit, next::DigitCollection &digits, Huffman * huffman, std::vector<int> &channelMaskVec, int *positions, int timeinmus);
-  void decodeChargeIndiaSipmCompressed(int16_t* &buffer, int *current_bit, next::DigitCollection &digits, Huffman * huffman, std::vector<int> &channelMaskVec, int *positions, int* last_values, int timeinmus);
-  int computeSipmTime(int16_t * &ptr, next::EventReader * reader);
-  int sipmChannelMask(int16_t * &ptr, std::vector<int> &channelMaskVec, int febId);
+  void decodeChargeIndiaPmtCompressed(next::BitReader<int16_t*> &reader, next::DigitCollection &digits, HuffmanTable const & huffman, std::vector<int> &channelMaskVec, int *positions, int timeinmus);
+  void decodeChargeIndiaPmtCompressed(int16_t* &buffer, int *current_bit, next::DigitCollection &digits, HuffmanTable const & huffman, std::vector<int> &channelMaskVec, int *positions, int timeinmus);
+  void decodeIndiaPmtCompressed(int16_t * stream, size_t bits, next::DigitCollection &digits, HuffmanTable const & huffman, std::vector<int> &channelMaskVec, int *positions, int samples);
+  template <typename Ptr>
+  void decodeChargeIndiaSipmCompressed(next::BitReader<Ptr> &reader, HuffmanTable const & huffman, std::vector<int> &channelMaskVec, int timeinmus);
+  void readSipmCompressedFeb(next::SipmLinkCursor &ptr, std::vector<int> &channelMaskVec, int time);
+  void reconstructSipmCompressed(next::DigitCollection &digits, int *positions, int* last_values);
+  template <typename Ptr>
+  int computeSipmTime(Ptr &ptr, next::EventReader * reader);
+  template <typename Ptr>
+  int sipmChannelMask(Ptr &ptr, std::vector<int> &channelMaskVec, int febId);
   int pmtsChannelMask(int16_t chmask, std::vector<int> &channelMaskVec, int fecId, int FWVersion);
 
   //function for tests
-  Huffman* getHuffmanTree();
+  HuffmanTable* getHuffmanTree();
 
   void writeEvent();
 
   bool errors();
 
 private:
+  bool readListedEvent(bool toSkip);
+  bool decodeEvent();
+
   /// This is temporary (hope) to convert the FT times to us in the digit
   /// tdc.
   static double const CLOCK_TICK_;
 
-  /// Retrieve DATE event header size stored in the raw data.
-  /// 80 bytes for the newer DAQ (DATE event header format 3.14)
-  unsigned int readHeaderSize(std::FILE* fptr) const;
-
   size_t run_;
-  std::FILE* cfptr_; // current fptr
-  std::FILE* fptr1_; // gdc1
-  std::FILE* fptr2_; // gdc2
+  next::DATEMerger* input_; // events of all the gdc files
   int entriesThisFile_;
   eventHeaderStruct * event_;      // raw data super event
   int eventNo_;
   int skip_;
   int max_events_;
   unsigned char* buffer_;
+  std::vector<int> events_; // Event numbers to decode, all if empty
+  bool follow_; // Decode the files while the DAQ writes them
+  bool streamSubEvents_; // Read the events one equipment at a time
+  eventHeaderStruct eventHeader_; // Header of the event read by parts
+  std::vector<unsigned char> equipmentBuffer_; // Payload of the equipment read by parts
+  std::vector<int16_t> flipBuffer_; // Equipment payload after flipWords, grows to the largest one
 
   int fFecId; /// Number of the FEC
   int fFirstFT; /// Buffer position in the electronics
@@ -114,15 +148,21 @@ private:
   int fMaxSample; /// Maximum samples in a circular buffer section (65536)
 
   //Sipm separate streams variables
-  //char payloadSipm[5000000*NUM_FEC_SIPM];
-  char * payloadSipm;
   bool sipmFec[NUM_FEC_SIPM]; //Store which sipm fec channels has been read
-  int16_t * payloadSipmPtr[NUM_FEC_SIPM]; //Store pointers to the payload
+  std::vector<int16_t> sipmLinks_[NUM_FEC_SIPM]; //First link of each pair until its partner is read
+  size_t sipmLinkStart_[NUM_FEC_SIPM]; //Position of the link payload in sipmLinks_
   //To aid search of SiPM digits
   int sipmPosition[NSIPMS]; //Num FEBs * 64
   int sipmLastValues[NSIPMS]; //For Sipm with ZS+Compression
   int pmtPosition[NPMTS];
 
+  //Compressed symbols of a FEC (pair), kept between events
+  std::vector<int> compressedDeltas_; //Difference with the previous value, or the 12-bit value
+  std::vector<int> compressedKeep_;   //-1 for a difference, 0 for a 12-bit value
+  std::vector<int> compressedValues_;
+  std::vector<int> compressedChannels_; //SiPMs only
+  std::vector<int> compressedTimes_;
+
   //Relation between real channels & BLR ones
   const std::vector<int> channelsRelation {2,3,0,1, 6,7,4,5, 10,11,8,9, 14,15,12,13, 18,19,16,17, 22,23,20,21, 26,27,24,25, 30,31,28,29};
   const std::vector<int> channelsRelationIndia {12,13,14,15, 16,17,18,19, 20,21,22,23, 0,1,2,3, 4,5,6,7, 8,9,10,11, 36,37,38,39, 40,41,42,43, 44,45,46,47, 24,25,26,27, 28,29,30,31, 32,33,34,35};
@@ -162,7 +202,6 @@ private:
 
   //Attributes to read from two files
   bool twoFiles_; // If true, gdc1 & gdc2 will be read
-  bool nextGdc2_; // If true, next event will be read from gdc2
 
   //If true, discard FECs with ErrorBit true
   bool discard_;
@@ -183,8 +222,12 @@ private:
 
   bool fileError_, eventError_;
   ReadConfig * config_;
-  Huffman huffmanPmt_;
-  Huffman huffmanSipm_;
+  HuffmanTable huffmanPmt_;
+  HuffmanTable huffmanSipm_;
+  int huffmanPmtRun_;  // Run of the codes loaded, -1 if none
+  int huffmanSipmRun_;
+
+  std::unique_ptr<next::ThreadPool> decodePool_; // Threads of the parallel decoders, none with decode_threads 1
 
 };
 
@@ -193,11 +236,28 @@ inline bool RawDataInput::errors(){return fileError_;}
 }
 
 void flipWords(unsigned int size, int16_t* in, int16_t* out);
+/// Original one pair at a time version of flipWords
+void flipWordsScalar(unsigned int size, int16_t* in, int16_t* out);
+/// Unpacks count 12-bit charges, 4 every 3 words
+void unpackSamples12(int16_t const * in, int count, uint16_t * out);
+void unpackSamples12Scalar(int16_t const * in, int count, uint16_t * out);
+/// Unpacks count RAW PMT records (FT word and 12-bit charges) into one
+/// waveform per channel, in blocks of RAW_BLOCK_SAMPLES on pool if given
+void decodePmtRawSamples(next::ThreadPool * pool, int16_t const * buffer, int nchannels, int count, unsigned short ** waveforms);
+/// out[i] = deltas[i] + out[i-1] (carry for i=0), or deltas[i] alone
+/// where keep[i] is 0 (-1 otherwise)
+void reconstructDeltas(int const * deltas, int const * keep, int count, int carry, int * out);
+void reconstructDeltasScalar(int const * deltas, int const * keep, int count, int carry, int * out);
+/// Decodes the channels x samples symbols of a compressed PMT stream,
+/// time after time, into one array per channel (see reconstructDeltas)
+void decodeCompressedSymbols(next::BitReader<int16_t*> &reader, HuffmanTable const & huffman, int channels, int samples, int * deltas, int * keep);
+/// Same, decoding segments of the first bits of stream at the same time
+int decodeCompressedSymbolsParallel(next::ThreadPool &pool, int16_t * stream, size_t bits, HuffmanTable const & huffman, int channels, int samples, int segments, int * deltas, int * keep);
 int computePmtElecID(int fecid, int channel, int version);
+int computePmtPosition(int fecid, int channel, int version);
 void buildSipmData(unsigned int size, int16_t* ptr, int16_t * ptrA, int16_t * ptrB);
-bool isEventSelected(eventHeaderStruct& event);
 void CreateSiPMs(next::DigitCollection * sipms, int * positions);
-void CreatePMTs(next::DigitCollection * pmts, int * positions, std::vector<int> * elecIDs, int bufferSize, bool zs);
+void CreatePMTs(next::DigitCollection * pmts, int * positions, std::vector<int> * elecIDs, int bufferSize, bool zs, int fwversion);
 void freeWaveformMemory(next::DigitCollection * sensors);
 
 void createWaveforms(next::DigitCollection * sensors, int bufferSamples);
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <fstream>
+#include <cstdlib>
 #include "config/ReadConfig.h"
 
 namespace spd = spdlog;
@@ -38,11 +39,30 @@ void ReadConfig::parse(){
 	_trgCode2   = _obj.get("trg_code2", 9).asInt();
 	_readPmts   = _obj.get("read_pmts", true).asBool();
 	_readSipms  = _obj.get("read_sipms", true).asBool();
+	_inputMode  = _obj.get("input_mode", "stdio").asString();
+	if (_inputMode != "stdio" && _inputMode != "mmap" &&
+			_inputMode != "block" && _inputMode != "stream"){
+		_log->error("Unknown input_mode {}, it must be stdio, mmap, block or stream", _inputMode);
+		exit(1);
+	}
+	_indexFiles = _obj.get("index_files", false).asBool();
+	_readAhead  = _obj.get("read_ahead", 0).asInt();
+	_hugePages  = _obj.get("huge_pages", false).asBool();
+	_follow     = _obj.get("follow", false).asBool();
+	_followTimeout = _obj.get("follow_timeout", 60).asInt();
+	_streamSubEvents = _obj.get("stream_subevents", false).asBool();
+	_blockSize  = _obj.get("block_size", 8 << 20).asInt();
+	_directIO   = _obj.get("direct_io", false).asBool();
+	_decodeThreads = _obj.get("decode_threads", 1).asInt();
 	_splitTrg   = _obj.get("split_trg", false).asBool();
 	_nodb       = _obj.get("no_db", false).asBool();
 	_discard    = _obj.get("discard", true).asBool();
 	_copyEvts   = _obj.get("copy_evts", false).asBool();
 	_skip       = _obj.get("skip", 0).asInt();
+	_events.clear();
+	for (auto const & evt : _obj["events"]){
+		_events.push_back(evt.asInt());
+	}
 	_host       = _obj.get("host", "neutrinos1.ific.uv.es").asString();
 	_user       = _obj.get("user", "nextreader").asString();
 	_passwd     = _obj.get("pass", "readonly").asString();
@@ -63,11 +83,20 @@ void ReadConfig::parse(){
 	_log->info("Trigger code 2: {}", _trgCode2);
 	_log->info("readPmts: {}", _readPmts);
 	_log->info("readSipms: {}", _readSipms);
+	_log->info("Input mode: {}", _inputMode);
+	_log->info("Block size: {} bytes, direct I/O: {}", _blockSize, _directIO);
+	_log->info("Decoding threads: {}", _decodeThreads);
+	_log->info("Index files: {}", _indexFiles);
+	_log->info("Read ahead: {} events", _readAhead);
+	_log->info("Huge pages for event buffers: {}", _hugePages);
+	_log->info("Follow input files: {} (timeout {} s)", _follow, _followTimeout);
+	_log->info("Stream sub-events: {}", _streamSubEvents);
 	_log->info("External trigger channel: {}", _extTrigger);
 	_log->info("Keep masked channels: {}", _nodb);
 	_log->info("Discard error events: {}", _discard);
 	_log->info("Copy events from input: {}", _copyEvts);
 	_log->info("Skip events: {}", _skip);
+	_log->info("Selected events: {}", _events.size());
 	_log->info("Host: {}", _host);
 	_log->info("Database name: {}", _dbname);
 }
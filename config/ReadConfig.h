@@ -7,6 +7,7 @@
 #endif
 
 #include <jsoncpp/json/json.h> // or jsoncpp/json.h , or json/json.h etc.
+#include <vector>
 
 class ReadConfig {
 	public:
@@ -33,6 +34,17 @@ class ReadConfig {
 		int  trgCode2();
 		bool readSipms();
 		bool readPmts();
+		std::string inputMode();
+		bool indexFiles();
+		int readAhead();
+		bool hugePages();
+		bool follow();
+		int followTimeout();
+		bool streamSubEvents();
+		int blockSize();
+		bool directIO();
+		int decodeThreads();
+		std::vector<int> events();
 		std::string host();
 		std::string user();
 		std::string pass();
@@ -63,6 +75,17 @@ class ReadConfig {
 		int _trgCode2;
 		bool _readPmts;
 		bool _readSipms;
+		std::string _inputMode;
+		bool _indexFiles;
+		int _readAhead;
+		bool _hugePages;
+		bool _follow;
+		int _followTimeout;
+		bool _streamSubEvents;
+		int _blockSize;
+		bool _directIO;
+		int _decodeThreads;
+		std::vector<int> _events;
 		std::string _host;
 		std::string _user;
 		std::string _passwd;
@@ -106,6 +129,28 @@ inline bool ReadConfig::readSipms(){return _readSipms;}
 
 inline bool ReadConfig::readPmts(){return _readPmts;}
 
+inline std::string ReadConfig::inputMode(){return _inputMode;}
+
+inline bool ReadConfig::indexFiles(){return _indexFiles;}
+
+inline int ReadConfig::readAhead(){return _readAhead;}
+
+inline bool ReadConfig::hugePages(){return _hugePages;}
+
+inline bool ReadConfig::follow(){return _follow;}
+
+inline int ReadConfig::followTimeout(){return _followTimeout;}
+
+inline bool ReadConfig::streamSubEvents(){return _streamSubEvents;}
+
+inline int ReadConfig::blockSize(){return _blockSize;}
+
+inline bool ReadConfig::directIO(){return _directIO;}
+
+inline int ReadConfig::decodeThreads(){return _decodeThreads;}
+
+inline std::vector<int> ReadConfig::events(){return _events;}
+
 inline std::string ReadConfig::host(){return _host;}
 
 inline std::string ReadConfig::user(){return _user;}
@@ -10,7 +10,8 @@ void finish_with_error(MYSQL *con, std::shared_ptr<spdlog::logger> log)
   exit(1);
 }
 
-void getHuffmanFromDB(ReadConfig * config, Huffman * huffman, int run_number, HuffmannSensor sensor){
+// Rows (value, code) with the Huffman codes of the run
+static std::vector<std::pair<int, std::string> > readHuffmanCodes(ReadConfig * config, int run_number, HuffmannSensor sensor){
 	MYSQL connection;
 	MYSQL * con = &connection;
 	mysql_init(con);
@@ -62,13 +63,32 @@ void getHuffmanFromDB(ReadConfig * config, Huffman * huffman, int run_number, Hu
 
 	MYSQL_ROW row;
 
+	std::vector<std::pair<int, std::string> > codes;
 	while ((row = mysql_fetch_row(result))){
-		parse_huffman_line(std::stoi(row[0]), row[1], huffman);
+		codes.emplace_back(std::stoi(row[0]), row[1]);
 	}
 
 	mysql_free_result(result);
 	mysql_close(con);
 
+	return codes;
+}
+
+void getHuffmanFromDB(ReadConfig * config, Huffman * huffman, int run_number, HuffmannSensor sensor){
+	auto codes = readHuffmanCodes(config, run_number, sensor);
+	for(auto & code : codes){
+		parse_huffman_line(code.first, &code.second[0], huffman);
+	}
+}
+
+// Replaces the codes in huffman with the ones of the run
+void getHuffmanFromDB(ReadConfig * config, HuffmanTable * huffman, int run_number, HuffmannSensor sensor){
+	auto codes = readHuffmanCodes(config, run_number, sensor);
+	huffman->clear();
+	for(auto & code : codes){
+		huffman->add(code.first, code.second.c_str());
+	}
+	huffman->build();
 }
 
 void getSensorsFromDB(ReadConfig * config, next::Sensors &sensors, int run_number, bool masked){
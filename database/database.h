@@ -18,3 +18,4 @@ enum class HuffmannSensor { sipm, pmt };
 void finish_with_error(MYSQL *con, std::shared_ptr<spdlog::logger> log);
 void getSensorsFromDB(ReadConfig * config, next::Sensors &sensors, int run_number, bool masked);
 void getHuffmanFromDB(ReadConfig * config, Huffman * huffman, int run_number, HuffmannSensor sensor);
+void getHuffmanFromDB(ReadConfig * config, HuffmanTable * huffman, int run_number, HuffmannSensor sensor);
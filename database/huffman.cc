@@ -34,6 +34,16 @@ int parse_huffman_line(int value, char * code, Huffman * huffman){
 }
 
 
+void free_huffman(Huffman * huffman){
+	for(int i=0; i<2; i++){
+		if(huffman->next[i]){
+			free_huffman(huffman->next[i]);
+			free(huffman->next[i]);
+			huffman->next[i] = NULL;
+		}
+	}
+}
+
 void printf_huffman(Huffman * huffman, int code){
 	// printf("code: %d\n", code);
 	// printf("next[0]: 0x%x\n", huffman->next[0]);
@@ -87,6 +97,134 @@ int decode_compressed_value(int previous_value, int data, int control_code, int
 	return wfvalue;
 }
 
+// Same as the tree version, resolving the code with the lookup table
+int decode_compressed_value(int previous_value, int data, int control_code, int * start_bit, HuffmanTable const & huffman){
+	int current_bit = *start_bit;
+
+	int wfvalue;
+	current_bit = huffman.decode(data, current_bit, &wfvalue);
+
+	if(wfvalue == control_code){
+		wfvalue = (data >> (current_bit - 11)) & 0x0FFF;
+		current_bit -= 12;
+	}else{
+		wfvalue = previous_value + wfvalue;
+	}
+	*start_bit = current_bit;
+
+	return wfvalue;
+}
+
+HuffmanTable::HuffmanTable(){
+	clear();
+}
+
+HuffmanTable::HuffmanTable(Huffman * tree){
+	build(tree);
+}
+
+void HuffmanTable::clear(){
+	HuffmanNode root;
+	root.value = 0;
+	root.next[0] = 0;
+	root.next[1] = 0;
+	nodes_.assign(1, root);
+	entries_.clear();
+}
+
+void HuffmanTable::add(int value, char const * code){
+	int node = 0;
+	for(int i=0; code[i]; i++){
+		int bit = code[i] - '0';
+		if(!nodes_[node].next[bit]){
+			HuffmanNode child;
+			child.value = 0;
+			child.next[0] = 0;
+			child.next[1] = 0;
+			nodes_.push_back(child);
+			nodes_[node].next[bit] = nodes_.size() - 1;
+		}
+		node = nodes_[node].next[bit];
+	}
+	nodes_[node].value = value;
+}
+
+void HuffmanTable::build(){
+	entries_.clear();
+	fill(0, HUFFMAN_TABLE_BITS);
+}
+
+void HuffmanTable::build(Huffman * tree){
+	clear();
+	copy(tree, 0);
+	build();
+}
+
+void HuffmanTable::copy(Huffman * tree, int node){
+	nodes_[node].value = tree->value;
+	for(int bit=0; bit<2; bit++){
+		if(tree->next[bit]){
+			HuffmanNode child;
+			child.value = 0;
+			child.next[0] = 0;
+			child.next[1] = 0;
+			nodes_.push_back(child);
+			nodes_[node].next[bit] = nodes_.size() - 1;
+			copy(tree->next[bit], nodes_[node].next[bit]);
+		}
+	}
+}
+
+// Adds the table for the codes under node, returns its offset. Every
+// index walks the tree with its bits, most significant first, until a
+// leaf or the end of the index; internal nodes reached there get their
+// own subtable.
+int HuffmanTable::fill(int node, int bits){
+	int offset = entries_.size();
+	entries_.resize(offset + (1 << bits));
+
+	for(int index=0; index < (1 << bits); index++){
+		int current = node;
+		int length = 0;
+		while(current >= 0 && !leaf(current) && length < bits){
+			int bit = (index >> (bits - 1 - length)) & 1;
+			current = nodes_[current].next[bit] ? nodes_[current].next[bit] : -1;
+			length++;
+		}
+
+		HuffmanEntry entry;
+		if(current < 0){
+			entry.value  = 0;
+			entry.length = length;
+		}else if(leaf(current)){
+			entry.value  = nodes_[current].value;
+			entry.length = length;
+		}else{
+			entry.value  = fill(current, HUFFMAN_SUBTABLE_BITS);
+			entry.length = -1;
+		}
+		entries_[offset + index] = entry;
+	}
+	return offset;
+}
+
+// Same output as print_huffman
+void HuffmanTable::print(std::shared_ptr<spdlog::logger> log) const{
+	print(log, 0, 1);
+}
+
+void HuffmanTable::print(std::shared_ptr<spdlog::logger> log, int node, int code) const{
+	for(int i=0; i<2; i++){
+		if(nodes_[node].next[i]){
+			print(log, nodes_[node].next[i], code * 10 + i);
+		}
+	}
+
+	if(leaf(node)){
+		log->debug("{}, {}", code, nodes_[node].value);
+	}
+}
+
 short int decode_huffman(Huffman * huffman, int code, int position, int * result){
 	int bit = CheckBit(code, position);
 	// printf("pos: %d, bit: %d\n", position, bit);
@@ -3,6 +3,8 @@
 #endif
 
 #include <iostream>
+#include <stdint.h>
+#include <vector>
 
 #ifndef _READCONFIG
 #include "config/ReadConfig.h"
@@ -21,11 +23,109 @@ struct Huffman {
 	Huffman * next[2];
 };
 
+#define HUFFMAN_TABLE_BITS 11   // bits resolved by the first lookup
+#define HUFFMAN_SUBTABLE_BITS 5 // bits of each lookup for longer codes
+
+struct HuffmanEntry {
+	int value;  // decoded value, or offset of the subtable
+	int length; // bits of the code in this lookup, -1 for a subtable
+};
+
+struct HuffmanNode {
+	int value;
+	int next[2]; // index of the children, 0 for none (0 is the root)
+};
+
+/// Huffman codes of a run. The code tree is kept in one node array and
+/// decoded with lookup tables: each lookup takes the next
+/// HUFFMAN_TABLE_BITS bits and resolves every code up to that length,
+/// longer codes continue in subtables of HUFFMAN_SUBTABLE_BITS. Codes
+/// missing from the tree decode as 0.
+/// A table can be built from a Huffman tree, which has to be done once
+/// before decoding, not on every call.
+class HuffmanTable {
+public:
+	HuffmanTable();
+	explicit HuffmanTable(Huffman * tree);
+
+	/// Removes all the codes
+	void clear();
+	/// Adds the code given as a string of '0' and '1'
+	void add(int value, char const * code);
+	/// Builds the lookup tables once all the codes are added
+	void build();
+	void build(Huffman * tree);
+	bool empty() const;
+
+	/// Same as decode_huffman: decodes the code starting at bit position
+	/// of code, returns the position after it
+	int decode(int code, int position, int * result) const;
+
+	void print(std::shared_ptr<spdlog::logger> log) const;
+
+private:
+	int fill(int node, int bits);
+	void copy(Huffman * tree, int node);
+	void print(std::shared_ptr<spdlog::logger> log, int node, int code) const;
+	bool leaf(int node) const;
+
+	std::vector<HuffmanNode> nodes_;
+	std::vector<HuffmanEntry> entries_;
+};
+
+inline bool HuffmanTable::empty() const {return entries_.empty();}
+inline bool HuffmanTable::leaf(int node) const {return !(nodes_[node].next[0] || nodes_[node].next[1]);}
+
+inline int HuffmanTable::decode(int code, int position, int * result) const {
+	// Bit position of code on the top bit, zeros after bit 0
+	uint64_t bits = (uint64_t) (uint32_t) code << (63 - position);
+	int offset = 0;
+	int nbits = HUFFMAN_TABLE_BITS;
+	while (true){
+		HuffmanEntry const & entry = entries_[offset + (bits >> (64 - nbits))];
+		if (entry.length >= 0){
+			*result = entry.value;
+			return position - entry.length;
+		}
+		bits <<= nbits;
+		position -= nbits;
+		offset = entry.value;
+		nbits = HUFFMAN_SUBTABLE_BITS;
+	}
+}
+
 //int parse_huffman_line(std::string &line, Huffman * huffman);
 //void print_huffman(Huffman * huffman, int code);
 void print_huffman(std::shared_ptr<spdlog::logger> log, Huffman * huffman, int code);
 void printf_huffman(Huffman * huffman, int code);
 int parse_huffman_line(int value, char * code, Huffman * huffman);
+void free_huffman(Huffman * huffman);
 int decode_compressed_value(int previous_value, int data, int control_code, int * start_bit, Huffman * huffman);
+int decode_compressed_value(int previous_value, int data, int control_code, int * start_bit, HuffmanTable const & huffman);
 short int decode_huffman(Huffman * huffman, int code, int position, int * result);
 
+/// Reads the next symbol from reader (a next::BitReader). Returns true
+/// for the control code, with the 12-bit value after it in value, false
+/// for a difference with the previous value
+template <typename Reader>
+inline bool decode_compressed_symbol(Reader & reader, int control_code, HuffmanTable const & huffman, int * value){
+	int position = huffman.decode((int) reader.peek32(), 31, value);
+	reader.consume(31 - position);
+
+	if(*value == control_code){
+		*value = reader.read(12);
+		return true;
+	}
+	return false;
+}
+
+/// Same as decode_compressed_value, taking the bits from reader
+template <typename Reader>
+inline int decode_compressed_value(int previous_value, Reader & reader, int control_code, HuffmanTable const & huffman){
+	int wfvalue;
+	if(!decode_compressed_symbol(reader, control_code, huffman, &wfvalue)){
+		wfvalue = previous_value + wfvalue;
+	}
+	return wfvalue;
+}
+
@@ -0,0 +1,77 @@
+#ifndef _BITREADER
+#define _BITREADER
+#endif
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace next {
+
+  /// BitReader reads a stream of bits stored most significant first in
+  /// 16-bit words, as the compressed payloads are. Ptr is an int16_t* or
+  /// anything with the same operations (SipmLinkCursor).
+  /// Whole words are loaded into a 64-bit buffer when the bits asked for
+  /// are not there yet, so up to 3 words after the current one may be
+  /// read. Reads and peeks are of at most 32 bits.
+
+  template <typename Ptr>
+  class BitReader
+  {
+  public:
+    /// skip bits of the first word are taken as already read
+    BitReader(Ptr start, int skip = 0) :
+      start_(start), next_(start), buffer_(0), count_(0), consumed_(0)
+    {
+      consume(skip);
+    }
+
+    /// Next 32 bits, the first one on the top bit
+    uint32_t peek32()
+    {
+      fill(32);
+      return buffer_ >> 32;
+    }
+
+    uint32_t read(int n)
+    {
+      fill(n);
+      uint32_t value = buffer_ >> (64 - n);
+      consume(n);
+      return value;
+    }
+
+    void consume(int n)
+    {
+      fill(n);
+      buffer_ <<= n;
+      count_ -= n;
+      consumed_ += n;
+    }
+
+    /// Skips the rest of the current word, if it has been started
+    void align() { consume((16 - consumed_ % 16) % 16); }
+
+    /// Word with the next bit to read (the next word once aligned)
+    Ptr word() const { return start_ + consumed_ / 16; }
+    /// Bits already read of that word
+    int bitInWord() const { return consumed_ % 16; }
+    size_t consumed() const { return consumed_; }
+
+  private:
+    void fill(int n)
+    {
+      while (count_ < n){
+        buffer_ |= (uint64_t) (uint16_t) *next_ << (48 - count_);
+        ++next_;
+        count_ += 16;
+      }
+    }
+
+    Ptr start_;
+    Ptr next_;         // Next word to load
+    uint64_t buffer_;  // Loaded bits not read yet, from the top bit
+    int count_;        // Bits in buffer_
+    size_t consumed_;  // Bits read since start_
+  }; //class BitReader
+
+}
@@ -0,0 +1,89 @@
+#include "detail/BufferPool.h"
+
+#include <iterator>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+next::BufferPool::BufferPool(bool hugePages) :
+	hugePages_(hugePages),
+	allocated_(0)
+{
+}
+
+next::BufferPool::~BufferPool(){
+	for (auto const & buffer : capacity_){
+		deallocate(buffer.first, buffer.second);
+	}
+}
+
+// Sizes are rounded up to whole (huge) pages, what is left over is
+// used when a later event is a bit bigger
+unsigned char * next::BufferPool::allocate(size_t size, size_t * capacity){
+	size_t page = hugePages_ ? HUGE_PAGE_SIZE : sysconf(_SC_PAGESIZE);
+	*capacity = (size + page - 1) / page * page;
+	if (!*capacity){
+		*capacity = page;
+	}
+	void * buffer = mmap(NULL, *capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (buffer == MAP_FAILED){
+		return NULL;
+	}
+#ifdef MADV_HUGEPAGE
+	if (hugePages_){
+		madvise(buffer, *capacity, MADV_HUGEPAGE);
+	}
+#endif
+	allocated_ += *capacity;
+	return (unsigned char *) buffer;
+}
+
+void next::BufferPool::deallocate(unsigned char * buffer, size_t capacity){
+	munmap(buffer, capacity);
+	allocated_ -= capacity;
+}
+
+unsigned char * next::BufferPool::acquire(size_t size){
+	std::lock_guard<std::mutex> lock(mutex_);
+
+	auto it = free_.lower_bound(size);
+	if (it != free_.end()){
+		unsigned char * buffer = it->second;
+		free_.erase(it);
+		return buffer;
+	}
+
+	// Grow: the largest free buffer is too small, replace it
+	if (!free_.empty()){
+		auto largest = std::prev(free_.end());
+		capacity_.erase(largest->second);
+		deallocate(largest->second, largest->first);
+		free_.erase(largest);
+	}
+
+	size_t capacity;
+	unsigned char * buffer = allocate(size, &capacity);
+	if (buffer){
+		capacity_[buffer] = capacity;
+	}
+	return buffer;
+}
+
+void next::BufferPool::release(unsigned char * buffer){
+	std::lock_guard<std::mutex> lock(mutex_);
+	auto it = capacity_.find(buffer);
+	if (it != capacity_.end()){
+		free_.insert(std::make_pair(it->second, buffer));
+	}
+}
+
+size_t next::BufferPool::buffers() const{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return capacity_.size();
+}
+
+size_t next::BufferPool::allocatedBytes() const{
+	std::lock_guard<std::mutex> lock(mutex_);
+	return allocated_;
+}
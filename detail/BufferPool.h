@@ -0,0 +1,42 @@
+#ifndef _BUFFERPOOL
+#define _BUFFERPOOL
+#endif
+
+#include <cstddef>
+#include <map>
+#include <mutex>
+
+namespace next {
+
+  /// BufferPool keeps the event buffers once they are given back so the
+  /// next events reuse them instead of allocating (and page faulting)
+  /// fresh memory. Buffers only grow: when no free buffer is big enough
+  /// the largest free one is replaced by a bigger one.
+  /// Buffers are anonymous mappings, optionally with transparent huge
+  /// pages. It can be used from several threads.
+
+  class BufferPool
+  {
+  public:
+    BufferPool(bool hugePages);
+    ~BufferPool();
+
+    /// Returns a buffer of at least size bytes
+    unsigned char * acquire(size_t size);
+    void release(unsigned char * buffer);
+
+    size_t buffers() const;
+    size_t allocatedBytes() const;
+
+  private:
+    unsigned char * allocate(size_t size, size_t * capacity);
+    void deallocate(unsigned char * buffer, size_t capacity);
+
+    bool hugePages_;
+    std::map<unsigned char *, size_t> capacity_;   // All the buffers
+    std::multimap<size_t, unsigned char *> free_;  // Free ones by capacity
+    size_t allocated_;
+    mutable std::mutex mutex_;
+  }; //class BufferPool
+
+}
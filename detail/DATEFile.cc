@@ -0,0 +1,1287 @@
+#include "detail/DATEFile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace spd = spdlog;
+
+static bool isEventTypeSelected(uint32_t type){
+	return type == PHYSICS_EVENT || type == CALIBRATION_EVENT;
+}
+
+// O_DIRECT needs buffers, offsets and sizes aligned to the logical
+// block size of the device, never bigger than a page
+static const int BLOCK_ALIGNMENT = 4096;
+
+// Events are handed out as pointers into the mapping and flipWords reads
+// a few words past their end, so an anonymous page follows the file:
+// an event ending on the last page of the file would fault otherwise
+static size_t mappedLength(size_t fileSize){
+	size_t page = sysconf(_SC_PAGESIZE);
+	return (fileSize + page - 1) / page * page + page;
+}
+
+static unsigned char * mapFile(int fd, size_t fileSize){
+	size_t length = mappedLength(fileSize);
+	void * area = mmap(NULL, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (area == MAP_FAILED){
+		return NULL;
+	}
+	if (mmap(area, fileSize, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED){
+		munmap(area, length);
+		return NULL;
+	}
+	return (unsigned char*) area;
+}
+
+// Sidecar index file layout: this header followed by the entries.
+// Size and modification time of the data file are stored to detect
+// stale index files, and as they can match after a rewrite, a copy of
+// the headers of the first and last events too.
+static const char INDEX_MAGIC[8] = {'D','A','T','E','I','D','X','\0'};
+static const uint32_t INDEX_VERSION = 2;
+
+struct IndexFileHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t entrySize;
+	uint64_t fileSize;
+	int64_t fileMtime;
+	uint64_t entries;
+	eventHeaderStruct firstHeader;
+	eventHeaderStruct lastHeader;
+};
+
+next::InputMode next::parseInputMode(std::string const & mode){
+	if (mode == "mmap"){
+		return InputMode::mmap;
+	}
+	if (mode == "block"){
+		return InputMode::block;
+	}
+	if (mode == "stream"){
+		return InputMode::stream;
+	}
+	return InputMode::stdio;
+}
+
+next::DATEFile::DATEFile(std::string const & filename, ReadConfig * config, BufferPool * pool) :
+	filename_(filename),
+	indexFilename_(filename + ".idx"),
+	mode_(parseInputMode(config->inputMode())),
+	useIndexFile_(config->indexFiles()),
+	follow_(config->follow()),
+	followTimeout_(config->followTimeout()),
+	fptr_(NULL),
+	filePos_(0),
+	next_(0),
+	selected_(0),
+	firstEvent_(-1),
+	scanEnd_(0),
+	endOfRun_(false),
+	fd_(-1),
+	map_(NULL),
+	mapSize_(0),
+	released_(0),
+	advised_(0),
+	blockSize_((std::max(config->blockSize(), 1) + BLOCK_ALIGNMENT - 1) / BLOCK_ALIGNMENT * BLOCK_ALIGNMENT),
+	directIO_(config->directIO()),
+	block_(NULL),
+	blockStart_(0),
+	blockBytes_(0),
+	readAhead_(config->readAhead() > 0 ? config->readAhead() : 0),
+	prefetchNext_(0),
+	prefetching_(false),
+	prefetchDone_(false),
+	stopPrefetch_(false),
+	pool_(pool),
+	ownPool_(NULL),
+	peeked_(NULL),
+	decompressor_(NULL),
+	partialOffset_(0),
+	partialSize_(0),
+	partialRead_(0),
+	partialBuffer_(NULL)
+{
+	if (!pool_){
+		ownPool_ = new BufferPool(config->hugePages());
+		pool_ = ownPool_;
+	}
+	// This declaration avoid errors when creating more than one file
+	static auto log = spd::stdout_color_mt("datefile");
+	_log = log;
+}
+
+next::DATEFile::~DATEFile(){
+	close();
+	free(block_);
+	delete ownPool_;
+}
+
+// stdin ("-"), FIFOs and sockets can only be read forward
+static bool isStreamInput(std::string const & filename){
+	struct stat st;
+	return filename == "-" ||
+		(stat(filename.c_str(), &st) == 0 && (S_ISFIFO(st.st_mode) || S_ISSOCK(st.st_mode)));
+}
+
+bool next::DATEFile::open(){
+	Compression compression = detectCompression(filename_);
+	if (compression != Compression::none){
+		_log->info("Decompressing {} while reading it", filename_);
+		mode_ = InputMode::stream;
+		filePos_ = 0;
+		decompressor_ = new Decompressor(filename_, compression);
+		fd_ = decompressor_->start();
+		if (fd_ < 0){
+			delete decompressor_;
+			decompressor_ = NULL;
+			return false;
+		}
+		return true;
+	}
+
+	if (mode_ != InputMode::stream && isStreamInput(filename_)){
+		_log->info("Reading {} as a stream", filename_);
+		mode_ = InputMode::stream;
+	}
+	if (mode_ == InputMode::stream){
+		filePos_ = 0;
+		return openStream();
+	}
+
+	if (mode_ == InputMode::stdio || mode_ == InputMode::block){
+		fptr_ = std::fopen(filename_.c_str(), "rb");
+		filePos_ = 0;
+		if (fptr_ && mode_ == InputMode::block){
+			return openBlocks();
+		}
+		return fptr_ != NULL;
+	}
+
+	fd_ = ::open(filename_.c_str(), O_RDONLY);
+	if (fd_ < 0){
+		return false;
+	}
+
+	struct stat st;
+	if (fstat(fd_, &st) < 0){
+		::close(fd_);
+		fd_ = -1;
+		return false;
+	}
+
+	mapSize_ = st.st_size;
+	if (mapSize_ > 0){
+		unsigned char * map = mapFile(fd_, mapSize_);
+		if (!map){
+			_log->warn("Unable to mmap {}, falling back to stdio", filename_);
+			::close(fd_);
+			fd_ = -1;
+			mapSize_ = 0;
+			mode_ = InputMode::stdio;
+			return open();
+		}
+		map_ = map;
+		// Events are read once from start to end
+		madvise(map_, mapSize_, MADV_SEQUENTIAL);
+	}
+	released_ = 0;
+	advised_  = 0;
+	return true;
+}
+
+bool next::DATEFile::openStream(){
+	if (filename_ == "-"){
+		fd_ = STDIN_FILENO;
+		return true;
+	}
+
+	struct stat st;
+	if (stat(filename_.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)){
+		fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd_ < 0){
+			return false;
+		}
+		struct sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strncpy(addr.sun_path, filename_.c_str(), sizeof(addr.sun_path) - 1);
+		if (connect(fd_, (struct sockaddr *) &addr, sizeof(addr)) < 0){
+			::close(fd_);
+			fd_ = -1;
+			return false;
+		}
+		return true;
+	}
+
+	fd_ = ::open(filename_.c_str(), O_RDONLY);
+	return fd_ >= 0;
+}
+
+// Headers are read through fptr_ with random access advice, so the
+// scan does not read ahead the payloads
+bool next::DATEFile::openBlocks(){
+	posix_fadvise(fileno(fptr_), 0, 0, POSIX_FADV_RANDOM);
+#ifdef O_DIRECT
+	if (directIO_){
+		fd_ = ::open(filename_.c_str(), O_RDONLY | O_DIRECT);
+		if (fd_ < 0){
+			_log->warn("Direct I/O not available for {}, reading through the page cache", filename_);
+			directIO_ = false;
+		}
+	}
+#else
+	directIO_ = false;
+#endif
+	if (fd_ < 0){
+		fd_ = ::open(filename_.c_str(), O_RDONLY);
+		if (fd_ < 0){
+			close();
+			return false;
+		}
+		posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+	}
+
+	if (!block_ && posix_memalign((void **) &block_, BLOCK_ALIGNMENT, blockSize_)){
+		block_ = NULL;
+		_log->error("Unable to allocate a block of {} bytes", blockSize_);
+		close();
+		return false;
+	}
+	blockStart_ = 0;
+	blockBytes_ = 0;
+	released_   = 0;
+	return true;
+}
+
+void next::DATEFile::close(){
+	stopPrefetch();
+	if (peeked_){
+		pool_->release(peeked_);
+		peeked_ = NULL;
+	}
+	unread_.clear();
+	if (fptr_){
+		std::fclose(fptr_);
+		fptr_ = NULL;
+	}
+	if (map_){
+		munmap(map_, mappedLength(mapSize_));
+		map_ = NULL;
+		mapSize_ = 0;
+	}
+	if (decompressor_){
+		// It owns fd_
+		delete decompressor_;
+		decompressor_ = NULL;
+		fd_ = -1;
+	}
+	if (fd_ >= 0){
+		if (fd_ != STDIN_FILENO){
+			::close(fd_);
+		}
+		fd_ = -1;
+	}
+}
+
+void next::DATEFile::addIndexEntry(EventIndexEntry const & entry){
+	index_.push_back(entry);
+
+	if (isEventTypeSelected(entry.type)){
+		if (!selected_){
+			firstEvent_ = entry.nbInRun;
+		}
+		selectedIndex_.push_back(index_.size() - 1);
+		selected_++;
+	}
+	if (entry.type == END_OF_RUN){
+		endOfRun_ = true;
+	}
+}
+
+static const size_t RESYNC_CHUNK = 1 << 20;
+
+static next::EventIndexEntry indexEntry(uint64_t offset, eventHeaderStruct const & header){
+	next::EventIndexEntry entry;
+	entry.offset    = offset;
+	entry.size      = header.eventSize;
+	entry.type      = header.eventType;
+	entry.nbInRun   = EVENT_ID_GET_NB_IN_RUN(header.eventId);
+	entry.timestamp = header.eventTimestampSec;
+	entry.gdc       = header.eventGdcId;
+	return entry;
+}
+
+bool next::DATEFile::statFile(struct stat * st) const{
+	if (!isOpen()){
+		return false;
+	}
+	int fd = (mode_ == InputMode::mmap) ? fd_ : fileno(fptr_);
+	return fstat(fd, st) == 0;
+}
+
+int next::DATEFile::buildIndex(){
+	stopPrefetch();
+	index_.clear();
+	selectedIndex_.clear();
+	next_       = 0;
+	selected_   = 0;
+	firstEvent_ = -1;
+	scanEnd_    = 0;
+	endOfRun_   = false;
+	if (!isOpen()){
+		return 0;
+	}
+	// Events of a stream are only known once read
+	if (mode_ == InputMode::stream){
+		return 0;
+	}
+
+	// Index files are not used for files still being written
+	if (useIndexFile_ && !follow_ && readIndexFile()){
+		_log->debug("Index read from {}", indexFilename_);
+		return selected_;
+	}
+
+	scanHeaders();
+
+	if (useIndexFile_ && !follow_){
+		writeIndexFile();
+	}
+	return selected_;
+}
+
+static bool validHeader(eventHeaderStruct const & header){
+	return header.eventMagic == EVENT_MAGIC_NUMBER &&
+		header.eventHeadSize == sizeof(eventHeaderStruct) &&
+		header.eventSize >= sizeof(eventHeaderStruct);
+}
+
+bool next::DATEFile::readHeader(uint64_t offset, eventHeaderStruct * header) const{
+	if (mode_ == InputMode::mmap){
+		memcpy(header, map_ + offset, sizeof(eventHeaderStruct));
+		return true;
+	}
+	return pread(fileno(fptr_), header, sizeof(eventHeaderStruct), offset) == sizeof(eventHeaderStruct);
+}
+
+// Only the 80 bytes of each header are read, the payload is skipped by
+// seeking eventSize bytes forward. The scan goes on from the end of the
+// last complete event found, so in follow mode only the new part of the
+// file is read.
+// A wrong header does not end the file: the next valid event is looked
+// for and the bytes in between are reported and skipped.
+void next::DATEFile::scanHeaders(){
+	unsigned int headerSize = sizeof(eventHeaderStruct);
+	uint64_t offset = scanEnd_;
+	uint64_t fileSize;
+	if (mode_ == InputMode::mmap){
+		fileSize = mapSize_;
+		// Avoid read-ahead of the payloads while jumping between headers
+		madvise(map_, mapSize_, MADV_RANDOM);
+	}else{
+		struct stat st;
+		fstat(fileno(fptr_), &st);
+		fileSize = st.st_size;
+	}
+
+	eventHeaderStruct header;
+	while (offset + headerSize <= fileSize && readHeader(offset, &header)){
+		bool valid = validHeader(header);
+		if (valid && offset + header.eventSize <= fileSize){
+			addIndexEntry(indexEntry(offset, header));
+			offset += header.eventSize;
+			continue;
+		}
+		if (valid && follow_){
+			truncatedEvent(offset);
+			break;
+		}
+
+		// Either the header or the size of the last event is corrupted
+		uint64_t next = findNextEvent(offset, fileSize);
+		if (next >= fileSize){
+			if (valid){
+				truncatedEvent(offset);
+			}else{
+				_log->error("Wrong event header at byte {} of {}, no valid event after it", offset, filename_);
+			}
+			break;
+		}
+		_log->error("Wrong event header at byte {} of {}, skipped {} bytes up to the next event", offset, filename_, next - offset);
+		offset = next;
+	}
+
+	if (mode_ == InputMode::mmap){
+		madvise(map_, mapSize_, MADV_SEQUENTIAL);
+	}
+	scanEnd_ = offset;
+}
+
+// A magic number inside the payload is not enough: the candidate must
+// be followed by another valid header, the end of the file, or in follow
+// mode be the event still being written.
+bool next::DATEFile::validEventAt(uint64_t offset, uint64_t fileSize) const{
+	eventHeaderStruct header;
+	if (!readHeader(offset, &header) || !validHeader(header)){
+		return false;
+	}
+	uint64_t end = offset + header.eventSize;
+	if (end > fileSize){
+		return follow_;
+	}
+	if (end + sizeof(eventHeaderStruct) > fileSize){
+		return true;
+	}
+	return readHeader(end, &header) && validHeader(header);
+}
+
+// Returns the offset of the first valid event after offset, fileSize if
+// there is none. The file is searched in chunks for the magic number.
+uint64_t next::DATEFile::findNextEvent(uint64_t offset, uint64_t fileSize) const{
+	unsigned int headerSize = sizeof(eventHeaderStruct);
+	unsigned int magicOffset = offsetof(eventHeaderStruct, eventMagic);
+	std::vector<unsigned char> chunk;
+	uint64_t pos = offset + 1;
+	while (pos + headerSize <= fileSize){
+		size_t size = std::min<uint64_t>(RESYNC_CHUNK, fileSize - pos);
+		unsigned char const * data;
+		if (mode_ == InputMode::mmap){
+			data = map_ + pos;
+		}else{
+			chunk.resize(size);
+			if (pread(fileno(fptr_), chunk.data(), size, pos) != (ssize_t) size){
+				break;
+			}
+			data = chunk.data();
+		}
+
+		size_t from = magicOffset;
+		while (from < size){
+			size_t found = from + findEventMagic(data + from, size - from);
+			if (found >= size){
+				break;
+			}
+			uint64_t candidate = pos + found - magicOffset;
+			if (validEventAt(candidate, fileSize)){
+				return candidate;
+			}
+			from = found + 1;
+		}
+		// Magic numbers cut at the end of the chunk are searched again
+		if (size <= headerSize){
+			break;
+		}
+		pos += size - headerSize;
+	}
+	return fileSize;
+}
+
+// While following a file the last event is usually still being written
+void next::DATEFile::truncatedEvent(uint64_t offset){
+	if (follow_){
+		_log->debug("Event at byte {} of {} not complete yet", offset, filename_);
+	}else{
+		_log->error("Truncated event at byte {} of {}", offset, filename_);
+	}
+}
+
+bool next::DATEFile::remap(size_t size){
+	unsigned char * map = mapFile(fd_, size);
+	if (!map){
+		_log->error("Unable to mmap {}", filename_);
+		return false;
+	}
+	if (map_){
+		munmap(map_, mappedLength(mapSize_));
+	}
+	map_     = map;
+	mapSize_ = size;
+	madvise(map_, mapSize_, MADV_SEQUENTIAL);
+	return true;
+}
+
+// Follow mode: waits until the DAQ appends new complete events to the
+// file and adds them to the index. Returns false once the end of run
+// event has been seen or when nothing arrives in followTimeout_ seconds.
+// All the events handed out must have been released, the mapping may
+// move.
+bool next::DATEFile::waitForEvents(){
+	if (!follow_ || endOfRun_){
+		return false;
+	}
+	// The thread reads the index, which is going to grow
+	stopPrefetch();
+
+	int selected = selected_;
+	auto start = std::chrono::steady_clock::now();
+	while (true){
+		struct stat st;
+		if (statFile(&st) && (uint64_t) st.st_size > scanEnd_){
+			size_t fileSize = st.st_size;
+			if (mode_ == InputMode::mmap && fileSize > mapSize_){
+				if (!remap(fileSize)){
+					return false;
+				}
+			}
+			scanHeaders();
+			if (fptr_){
+				// Drop what stdio buffered from the incomplete event
+				fseeko(fptr_, filePos_, SEEK_SET);
+			}
+			if (selected_ > selected){
+				return true;
+			}
+			if (endOfRun_){
+				_log->info("End of run found in {}", filename_);
+				return false;
+			}
+		}
+
+		auto waited = std::chrono::steady_clock::now() - start;
+		if (waited > std::chrono::seconds(followTimeout_)){
+			_log->info("No new events in {} for {} s, stop following it", filename_, followTimeout_);
+			follow_ = false;
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	}
+}
+
+// Returns false if there is no index file or it does not belong to the
+// current version of the data file
+bool next::DATEFile::readIndexFile(){
+	struct stat st;
+	if (!statFile(&st)){
+		return false;
+	}
+
+	std::FILE * file = std::fopen(indexFilename_.c_str(), "rb");
+	if (!file){
+		return false;
+	}
+
+	IndexFileHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+		!memcmp(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC)) &&
+		header.version == INDEX_VERSION &&
+		header.entrySize == sizeof(EventIndexEntry) &&
+		header.fileSize == (uint64_t) st.st_size &&
+		header.fileMtime == (int64_t) st.st_mtime;
+
+	if (!valid){
+		_log->info("Index file {} is outdated, rebuilding it", indexFilename_);
+		std::fclose(file);
+		return false;
+	}
+
+	std::vector<EventIndexEntry> entries(header.entries);
+	if (header.entries &&
+			fread(entries.data(), sizeof(EventIndexEntry), header.entries, file) != header.entries){
+		_log->warn("Index file {} is truncated, rebuilding it", indexFilename_);
+		std::fclose(file);
+		return false;
+	}
+	std::fclose(file);
+
+	for (auto const & entry : entries){
+		if (entry.offset + entry.size > (uint64_t) st.st_size){
+			_log->info("Index file {} points past the end of the file, rebuilding it", indexFilename_);
+			return false;
+		}
+	}
+	if (!entries.empty() &&
+			(!sameHeaderAt(entries.front().offset, header.firstHeader) ||
+			 !sameHeaderAt(entries.back().offset, header.lastHeader))){
+		_log->info("Index file {} does not match the events of {}, rebuilding it", indexFilename_, filename_);
+		return false;
+	}
+
+	for (auto const & entry : entries){
+		addIndexEntry(entry);
+	}
+	return true;
+}
+
+bool next::DATEFile::sameHeaderAt(uint64_t offset, eventHeaderStruct const & expected) const{
+	eventHeaderStruct header;
+	return readHeader(offset, &header) && !memcmp(&header, &expected, sizeof(header));
+}
+
+// The index is written to a temporary file and renamed so a concurrent
+// reader never sees a half written index. Failing to write it (e.g.
+// read-only data directory) is not an error.
+void next::DATEFile::writeIndexFile() const{
+	struct stat st;
+	if (!statFile(&st)){
+		return;
+	}
+
+	IndexFileHeader header;
+	memcpy(header.magic, INDEX_MAGIC, sizeof(INDEX_MAGIC));
+	header.version   = INDEX_VERSION;
+	header.entrySize = sizeof(EventIndexEntry);
+	header.fileSize  = st.st_size;
+	header.fileMtime = st.st_mtime;
+	header.entries   = index_.size();
+	memset(&header.firstHeader, 0, sizeof(header.firstHeader));
+	memset(&header.lastHeader, 0, sizeof(header.lastHeader));
+	if (!index_.empty() &&
+			(!readHeader(index_.front().offset, &header.firstHeader) ||
+			 !readHeader(index_.back().offset, &header.lastHeader))){
+		return;
+	}
+
+	std::string tmpFilename = indexFilename_ + ".tmp" + std::to_string(getpid());
+	std::FILE * file = std::fopen(tmpFilename.c_str(), "wb");
+	if (!file){
+		_log->warn("Unable to write index file {}", indexFilename_);
+		return;
+	}
+
+	bool ok = fwrite(&header, sizeof(header), 1, file) == 1;
+	if (ok && index_.size()){
+		ok = fwrite(index_.data(), sizeof(EventIndexEntry), index_.size(), file) == index_.size();
+	}
+	ok = (std::fclose(file) == 0) && ok;
+
+	if (!ok || rename(tmpFilename.c_str(), indexFilename_.c_str())){
+		_log->warn("Unable to write index file {}", indexFilename_);
+		remove(tmpFilename.c_str());
+	}
+}
+
+size_t next::DATEFile::nextSelected(size_t pos) const{
+	while (pos < index_.size() && !isEventTypeSelected(index_[pos].type)){
+		pos++;
+	}
+	return pos;
+}
+
+int next::DATEFile::skipEvent(){
+	if (mode_ == InputMode::stream){
+		unsigned char * buffer;
+		int evt_number = loadNextEvent(&buffer);
+		if (evt_number >= 0){
+			pool_->release(buffer);
+		}
+		return evt_number;
+	}
+
+	if (prefetching_){
+		PrefetchedEvent event;
+		while (!popPrefetched(&event)){
+			if (!waitForEvents()){
+				return -1;
+			}
+			startPrefetch();
+		}
+		pool_->release(event.buffer);
+		return index_[event.pos].nbInRun;
+	}
+
+	next_ = nextSelected(next_);
+	while (next_ >= index_.size()){
+		if (!waitForEvents()){
+			return -1;
+		}
+		next_ = nextSelected(next_);
+	}
+	return index_[next_++].nbInRun;
+}
+
+// Does not touch the read-ahead queue, it holds the events from next_ on
+int next::DATEFile::peekEvent(){
+	if (mode_ == InputMode::stream){
+		if (!peeked_){
+			peeked_ = readStreamEvent();
+		}
+		return peeked_ ? EVENT_ID_GET_NB_IN_RUN(((eventHeaderStruct*) peeked_)->eventId) : -1;
+	}
+
+	size_t pos = nextSelected(next_);
+	while (pos >= index_.size()){
+		if (!waitForEvents()){
+			return -1;
+		}
+		pos = nextSelected(next_);
+	}
+	return index_[pos].nbInRun;
+}
+
+// Event numbers grow along the file, so the selected events can be
+// binary searched
+bool next::DATEFile::seekEvent(int nbInRun){
+	if (mode_ == InputMode::stream){
+		return seekEventFrom(nbInRun) == nbInRun;
+	}
+
+	auto it = firstSelectedFrom(nbInRun);
+	if (it == selectedIndex_.end() || index_[*it].nbInRun != (uint32_t) nbInRun){
+		return false;
+	}
+	// Events queued by the read-ahead are not the ones wanted anymore
+	stopPrefetch();
+	next_ = *it;
+	return true;
+}
+
+int next::DATEFile::seekEventFrom(int nbInRun){
+	// Streams can only go forward, the events before are dropped
+	if (mode_ == InputMode::stream){
+		int evt_number = peekEvent();
+		while (evt_number >= 0 && evt_number < nbInRun){
+			skipEvent();
+			evt_number = peekEvent();
+		}
+		return evt_number;
+	}
+
+	auto it = firstSelectedFrom(nbInRun);
+	stopPrefetch();
+	if (it == selectedIndex_.end()){
+		next_ = index_.size();
+		return -1;
+	}
+	next_ = *it;
+	return index_[*it].nbInRun;
+}
+
+std::vector<size_t>::const_iterator next::DATEFile::firstSelectedFrom(int nbInRun) const{
+	return std::lower_bound(selectedIndex_.begin(), selectedIndex_.end(), (uint32_t) nbInRun,
+			[this](size_t pos, uint32_t nb){ return index_[pos].nbInRun < nb; });
+}
+
+int next::DATEFile::loadNextEvent(unsigned char ** buffer){
+	if (mode_ == InputMode::stream){
+		*buffer = peeked_ ? peeked_ : readStreamEvent();
+		peeked_ = NULL;
+		if (!*buffer){
+			return -1;
+		}
+		return EVENT_ID_GET_NB_IN_RUN(((eventHeaderStruct*) *buffer)->eventId);
+	}
+
+	if (mode_ == InputMode::stdio && readAhead_ > 0){
+		if (!prefetching_){
+			startPrefetch();
+		}
+		PrefetchedEvent event;
+		while (!popPrefetched(&event)){
+			if (!waitForEvents()){
+				return -1;
+			}
+			startPrefetch();
+		}
+		*buffer = event.buffer;
+		return index_[event.pos].nbInRun;
+	}
+
+	next_ = nextSelected(next_);
+	while (next_ >= index_.size()){
+		if (!waitForEvents()){
+			return -1;
+		}
+		next_ = nextSelected(next_);
+	}
+
+	EventIndexEntry const & entry = index_[next_];
+	next_++;
+	if (mode_ == InputMode::mmap){
+		//Hands out a pointer to the event inside the mapping, nothing is copied
+		*buffer = map_ + entry.offset;
+		willNeed(next_);
+		return entry.nbInRun;
+	}
+
+	*buffer = pool_->acquire(entry.size);
+	if (!*buffer){
+		_log->error("Unable to allocate {} bytes for the event at byte {} of {}", entry.size, entry.offset, filename_);
+		return -1;
+	}
+	bool read;
+	if (mode_ == InputMode::block){
+		read = readBlocks(entry.offset, entry.size, *buffer);
+	}else{
+		if (filePos_ != entry.offset){
+			fseeko(fptr_, entry.offset, SEEK_SET);
+		}
+		size_t bytes_read = fread(*buffer, 1, entry.size, fptr_);
+		filePos_ = entry.offset + bytes_read;
+		read = bytes_read == entry.size;
+		if (!read){
+			_log->error("Unable to read the event at byte {} of {}", entry.offset, filename_);
+		}
+	}
+	if (!read){
+		pool_->release(*buffer);
+		*buffer = NULL;
+		return -1;
+	}
+	return entry.nbInRun;
+}
+
+// Asks the kernel to start reading the next readAhead_ selected events
+// starting at index position pos
+void next::DATEFile::willNeed(size_t pos){
+	if (!readAhead_){
+		return;
+	}
+	size_t last = pos;
+	for (size_t n=0; n<readAhead_ && pos<index_.size(); n++){
+		pos  = nextSelected(pos);
+		if (pos < index_.size()){
+			last = pos;
+			pos++;
+		}
+	}
+	if (last >= index_.size()){
+		return;
+	}
+
+	size_t end   = index_[last].offset + index_[last].size;
+	size_t page  = sysconf(_SC_PAGESIZE);
+	size_t start = std::max(advised_, released_) / page * page;
+	if (end > start){
+		madvise(map_ + start, end - start, MADV_WILLNEED);
+		advised_ = end;
+	}
+}
+
+// Everything before the new block has been read, it is dropped from the
+// page cache, headers read by the index scan included
+bool next::DATEFile::loadBlock(uint64_t start){
+	if (start > released_){
+		posix_fadvise(fd_, released_, start - released_, POSIX_FADV_DONTNEED);
+		released_ = start;
+	}
+
+	size_t done = 0;
+	while (done < blockSize_){
+		ssize_t bytes = pread(fd_, block_ + done, blockSize_ - done, start + done);
+		if (bytes < 0 && errno == EINTR){
+			continue;
+		}
+		// At the end of the file O_DIRECT gives a short read, then fails
+		// on the unaligned offset
+		if (bytes <= 0){
+			break;
+		}
+		done += bytes;
+	}
+	blockStart_ = start;
+	blockBytes_ = done;
+	return done > 0;
+}
+
+bool next::DATEFile::readBlocks(uint64_t offset, size_t size, unsigned char * buffer){
+	while (size > 0){
+		if (offset < blockStart_ || offset >= blockStart_ + blockBytes_){
+			// In follow mode the block may have grown since it was read
+			if (!loadBlock(offset / blockSize_ * blockSize_) || offset >= blockStart_ + blockBytes_){
+				_log->error("Unable to read byte {} of {}", offset, filename_);
+				return false;
+			}
+		}
+		size_t bytes = std::min<uint64_t>(size, blockStart_ + blockBytes_ - offset);
+		memcpy(buffer, block_ + (offset - blockStart_), bytes);
+		buffer += bytes;
+		offset += bytes;
+		size   -= bytes;
+	}
+	return true;
+}
+
+// pread does not share the file position with fptr_, so the read-ahead
+// thread can use it freely
+bool next::DATEFile::readEntry(EventIndexEntry const & entry, unsigned char * buffer){
+	int fd = fileno(fptr_);
+	size_t done = 0;
+	while (done < entry.size){
+		ssize_t bytes = pread(fd, buffer + done, entry.size - done, entry.offset + done);
+		if (bytes <= 0){
+			_log->error("Unable to read event from file");
+			return false;
+		}
+		done += bytes;
+	}
+	return true;
+}
+
+void next::DATEFile::startPrefetch(){
+	queue_.clear();
+	prefetchNext_  = next_;
+	prefetchDone_  = false;
+	stopPrefetch_  = false;
+	prefetching_   = true;
+	prefetchThread_ = std::thread(&next::DATEFile::prefetchLoop, this);
+}
+
+// Stops the thread and throws away the events it has already read
+void next::DATEFile::stopPrefetch(){
+	if (!prefetching_){
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stopPrefetch_ = true;
+	}
+	cond_.notify_all();
+	prefetchThread_.join();
+	for (auto & event : queue_){
+		pool_->release(event.buffer);
+	}
+	queue_.clear();
+	prefetching_ = false;
+}
+
+void next::DATEFile::prefetchLoop(){
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (!stopPrefetch_){
+		if (queue_.size() >= readAhead_){
+			cond_.wait(lock);
+			continue;
+		}
+
+		size_t pos = nextSelected(prefetchNext_);
+		if (pos >= index_.size()){
+			break;
+		}
+		prefetchNext_ = pos + 1;
+		EventIndexEntry entry = index_[pos];
+
+		lock.unlock();
+		unsigned char * buffer = pool_->acquire(entry.size);
+		if (!buffer){
+			_log->error("Unable to allocate {} bytes for the event at byte {} of {}", entry.size, entry.offset, filename_);
+			lock.lock();
+			break;
+		}
+		if (!readEntry(entry, buffer)){
+			pool_->release(buffer);
+			lock.lock();
+			break;
+		}
+		lock.lock();
+
+		queue_.push_back({pos, buffer});
+		cond_.notify_all();
+	}
+	prefetchDone_ = true;
+	cond_.notify_all();
+}
+
+// Waits for the next event of the read-ahead queue. Returns false at
+// the end of the file
+bool next::DATEFile::popPrefetched(PrefetchedEvent * event){
+	std::unique_lock<std::mutex> lock(mutex_);
+	cond_.wait(lock, [this]{ return !queue_.empty() || prefetchDone_; });
+	if (queue_.empty()){
+		return false;
+	}
+	*event = queue_.front();
+	queue_.pop_front();
+	next_ = event->pos + 1;
+	cond_.notify_all();
+	return true;
+}
+
+// read() may return less than asked on pipes and sockets
+bool next::DATEFile::readFully(unsigned char * buffer, size_t size){
+	size_t done = std::min(size, unread_.size());
+	if (done){
+		memcpy(buffer, unread_.data(), done);
+		unread_.erase(unread_.begin(), unread_.begin() + done);
+		filePos_ += done;
+	}
+	while (done < size){
+		ssize_t bytes = read(fd_, buffer + done, size - done);
+		if (bytes < 0 && errno == EINTR){
+			continue;
+		}
+		if (bytes <= 0){
+			return false;
+		}
+		done += bytes;
+		filePos_ += bytes;
+	}
+	return true;
+}
+
+// Stream mode: reads events until a selected one, taking first the
+// header and then the rest of the event. Returns NULL at the end of the
+// stream.
+unsigned char * next::DATEFile::readStreamEvent(){
+	unsigned int headerSize = sizeof(eventHeaderStruct);
+	eventHeaderStruct header;
+	bool ok = readFully((unsigned char *) &header, headerSize);
+	while (ok){
+		if (!validHeader(header) && !resyncStream(&header)){
+			return NULL;
+		}
+		uint64_t offset = filePos_ - headerSize;
+
+		unsigned char * buffer = pool_->acquire(header.eventSize);
+		if (!buffer){
+			_log->error("Unable to allocate {} bytes for the event at byte {} of {}", header.eventSize, offset, filename_);
+			return NULL;
+		}
+		memcpy(buffer, &header, headerSize);
+		if (!readFully(buffer + headerSize, header.eventSize - headerSize)){
+			// A corrupted size swallows the rest of the stream, the events
+			// read after the header are looked for in what was read
+			size_t bytes = filePos_ - offset - headerSize;
+			unread_.assign(buffer + headerSize, buffer + headerSize + bytes);
+			filePos_ -= bytes;
+			pool_->release(buffer);
+			if (findEventMagic(unread_.data(), unread_.size()) == unread_.size()){
+				_log->error("Truncated event at byte {} of {}", offset, filename_);
+				return NULL;
+			}
+			ok = resyncStream(&header);
+			continue;
+		}
+
+		if (isEventTypeSelected(header.eventType)){
+			if (!selected_){
+				firstEvent_ = EVENT_ID_GET_NB_IN_RUN(header.eventId);
+			}
+			selected_++;
+			return buffer;
+		}
+		pool_->release(buffer);
+		ok = readFully((unsigned char *) &header, headerSize);
+	}
+	return NULL;
+}
+
+// Stream mode: header holds the wrong header just read. The stream is
+// read forward looking for the magic number of a valid header, which
+// is left in header. The bytes read after it are kept in unread_ for
+// the next reads. Returns false if the stream ends first.
+bool next::DATEFile::resyncStream(eventHeaderStruct * header){
+	unsigned int headerSize = sizeof(eventHeaderStruct);
+	unsigned int magicOffset = offsetof(eventHeaderStruct, eventMagic);
+	uint64_t offset = filePos_ - headerSize;
+
+	// data starts at byte start of the stream
+	std::vector<unsigned char> data((unsigned char *) header, (unsigned char *) header + headerSize);
+	data.insert(data.end(), unread_.begin(), unread_.end());
+	filePos_ += unread_.size();
+	unread_.clear();
+	uint64_t start = offset;
+	size_t from = 1 + magicOffset;
+	while (true){
+		size_t found = from + findEventMagic(data.data() + from, data.size() - from);
+		if (found < data.size()){
+			size_t candidate = found - magicOffset;
+			if (data.size() >= candidate + headerSize){
+				memcpy(header, data.data() + candidate, headerSize);
+				if (validHeader(*header)){
+					unread_.assign(data.begin() + candidate + headerSize, data.end());
+					filePos_ -= data.size() - candidate - headerSize;
+					_log->error("Wrong event header at byte {} of {}, skipped {} bytes up to the next event",
+							offset, filename_, start + candidate - offset);
+					return true;
+				}
+				from = found + 1;
+				continue;
+			}
+		}else{
+			// Keep the bytes where a header may start whose magic is not complete yet
+			size_t keep = std::min<size_t>(data.size(), magicOffset + sizeof(eventMagicType) - 1);
+			start += data.size() - keep;
+			data.erase(data.begin(), data.end() - keep);
+			from = 0;
+		}
+
+		// More data is needed
+		size_t size = data.size();
+		data.resize(size + RESYNC_CHUNK);
+		ssize_t bytes;
+		do {
+			bytes = read(fd_, data.data() + size, RESYNC_CHUNK);
+		} while (bytes < 0 && errno == EINTR);
+		if (bytes <= 0){
+			_log->error("Wrong event header at byte {} of {}, no valid event after it", offset, filename_);
+			return false;
+		}
+		data.resize(size + bytes);
+		filePos_ += bytes;
+	}
+}
+
+// Stream mode: reads headers until the one of a selected event, the
+// other events are skipped. Returns false at the end of the stream.
+bool next::DATEFile::readStreamHeader(eventHeaderStruct * header){
+	unsigned int headerSize = sizeof(eventHeaderStruct);
+	uint64_t offset = filePos_;
+	while (readFully((unsigned char *) header, headerSize)){
+		if (!validHeader(*header) && !resyncStream(header)){
+			return false;
+		}
+		if (isEventTypeSelected(header->eventType)){
+			if (!selected_){
+				firstEvent_ = EVENT_ID_GET_NB_IN_RUN(header->eventId);
+			}
+			selected_++;
+			return true;
+		}
+		if (!skipStream(header->eventSize - headerSize)){
+			_log->error("Truncated event at byte {} of {}", offset, filename_);
+			return false;
+		}
+		offset = filePos_;
+	}
+	return false;
+}
+
+bool next::DATEFile::skipStream(uint64_t size){
+	unsigned char scratch[65536];
+	while (size > 0){
+		size_t bytes = std::min<uint64_t>(size, sizeof(scratch));
+		if (!readFully(scratch, bytes)){
+			return false;
+		}
+		size -= bytes;
+	}
+	return true;
+}
+
+int next::DATEFile::loadNextEventHeader(eventHeaderStruct * header){
+	partialRead_   = 0;
+	partialBuffer_ = NULL;
+
+	if (mode_ == InputMode::stream){
+		if (peeked_){
+			// peekEvent already read the whole event
+			partialBuffer_ = peeked_;
+			peeked_ = NULL;
+			memcpy(header, partialBuffer_, sizeof(eventHeaderStruct));
+		}else if (readStreamHeader(header)){
+			partialRead_ = sizeof(eventHeaderStruct);
+		}else{
+			return -1;
+		}
+		partialSize_ = header->eventSize;
+		return EVENT_ID_GET_NB_IN_RUN(header->eventId);
+	}
+
+	// The read-ahead thread reads whole events, which is what is avoided here
+	stopPrefetch();
+	next_ = nextSelected(next_);
+	while (next_ >= index_.size()){
+		if (!waitForEvents()){
+			return -1;
+		}
+		next_ = nextSelected(next_);
+	}
+
+	EventIndexEntry const & entry = index_[next_];
+	next_++;
+	partialOffset_ = entry.offset;
+	partialSize_   = entry.size;
+	if (mode_ == InputMode::mmap){
+		partialBuffer_ = map_ + entry.offset;
+	}
+	if (!readEventPart(0, sizeof(eventHeaderStruct), (unsigned char *) header)){
+		return -1;
+	}
+	return entry.nbInRun;
+}
+
+bool next::DATEFile::readEventPart(uint64_t pos, size_t size, unsigned char * buffer){
+	if (pos + size > partialSize_){
+		_log->error("Read past the end of the event at byte {} of {}", partialOffset_, filename_);
+		return false;
+	}
+	if (partialBuffer_){
+		memcpy(buffer, partialBuffer_ + pos, size);
+		return true;
+	}
+
+	if (mode_ == InputMode::stream){
+		if (pos < partialRead_){
+			_log->error("Event parts of {} read backwards", filename_);
+			return false;
+		}
+		if (!skipStream(pos - partialRead_) || !readFully(buffer, size)){
+			_log->error("Truncated event in {}", filename_);
+			return false;
+		}
+		partialRead_ = pos + size;
+		return true;
+	}
+
+	if (mode_ == InputMode::block){
+		return readBlocks(partialOffset_ + pos, size, buffer);
+	}
+	EventIndexEntry part = {partialOffset_ + pos, (uint32_t) size, 0, 0, 0, 0};
+	return readEntry(part, buffer);
+}
+
+void next::DATEFile::finishEvent(){
+	if (mode_ == InputMode::mmap && partialBuffer_){
+		releaseEvent(partialBuffer_);
+	}else if (partialBuffer_){
+		pool_->release(partialBuffer_);
+	}else if (mode_ == InputMode::stream && partialRead_ < partialSize_){
+		skipStream(partialSize_ - partialRead_);
+	}
+	partialBuffer_ = NULL;
+	partialRead_   = partialSize_;
+}
+
+// Events have to be released in the same order they were loaded.
+// In mmap mode the pages already consumed are dropped so a multi-GB run
+// does not stay resident.
+void next::DATEFile::releaseEvent(unsigned char * buffer){
+	if (mode_ != InputMode::mmap){
+		pool_->release(buffer);
+		return;
+	}
+
+	eventHeaderStruct * header = (eventHeaderStruct*) buffer;
+	size_t end   = (buffer - map_) + header->eventSize;
+	size_t page  = sysconf(_SC_PAGESIZE);
+	size_t limit = end / page * page;
+	if (limit > released_){
+		madvise(map_ + released_, limit - released_, MADV_DONTNEED);
+		released_ = limit;
+	}
+}
+
+bool isEventSelected(eventHeaderStruct const & event){
+	return isEventTypeSelected(event.eventType);
+}
+
+// memchr finds the candidates for the first byte much faster than a
+// byte by byte loop, only those are compared whole
+size_t findEventMagic(unsigned char const * data, size_t size){
+	eventMagicType magic = EVENT_MAGIC_NUMBER;
+	unsigned char const * bytes = (unsigned char const *) &magic;
+	unsigned char const * end = data + size;
+	unsigned char const * pos = data;
+	while (end - pos >= (ptrdiff_t) sizeof(magic)){
+		pos = (unsigned char const *) memchr(pos, bytes[0], end - pos - sizeof(magic) + 1);
+		if (!pos){
+			break;
+		}
+		if (!memcmp(pos, bytes, sizeof(magic))){
+			return pos - data;
+		}
+		pos++;
+	}
+	return size;
+}
@@ -0,0 +1,250 @@
+#ifndef _DATEFILE
+#define _DATEFILE
+#endif
+
+#ifndef SPDLOG_VERSION
+#include "spdlog/spdlog.h"
+#endif
+
+#ifndef _READCONFIG
+#include "config/ReadConfig.h"
+#endif
+
+#ifndef _BUFFERPOOL
+#include "detail/BufferPool.h"
+#endif
+
+#ifndef _DECOMPRESSOR
+#include "detail/Decompressor.h"
+#endif
+
+#include "detail/event.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+namespace next {
+
+  /// Ways of getting the events out of a DATE file
+  ///  - stdio: fread each event into a buffer from a BufferPool
+  ///  - mmap: map the whole file and hand out pointers into the mapping
+  ///  - block: read the file in aligned blocks of block_size bytes,
+  ///    dropping the blocks already read from the page cache, so a bulk
+  ///    decode does not evict the data of other jobs. With direct_io
+  ///    the blocks bypass the page cache (O_DIRECT)
+  ///  - stream: read strictly forward, without index. Used for stdin
+  ///    ("-"), FIFOs, UNIX sockets and gzip/zstd compressed files
+  ///    whatever the configured mode
+  enum class InputMode { stdio, mmap, block, stream };
+
+  InputMode parseInputMode(std::string const & mode);
+
+  /// One entry per event found in the file, selected or not
+  struct EventIndexEntry {
+    uint64_t offset;    // Position of the event header in the file
+    uint32_t size;      // eventSize, header included
+    uint32_t type;      // eventType
+    uint32_t nbInRun;   // EVENT_ID_GET_NB_IN_RUN
+    uint32_t timestamp; // eventTimestampSec
+    uint32_t gdc;       // eventGdcId
+  };
+
+  /// Event already read by the read-ahead thread
+  struct PrefetchedEvent {
+    size_t pos;             // Position in the index
+    unsigned char * buffer;
+  };
+
+  /// DATEFile reads the events written by one GDC.
+  /// The aim of this class is to share the file access between
+  /// RawDataInput and CopyEvents
+
+  class DATEFile
+  {
+  public:
+    /// Events read in stdio mode go to buffers taken from pool, which
+    /// can be shared between files. Without it the file has its own.
+    DATEFile(std::string const & filename, ReadConfig * config, BufferPool * pool = NULL);
+    ~DATEFile();
+
+    /// Returns false if the file cannot be opened
+    bool open();
+    void close();
+    bool isOpen() const;
+
+    /// False when the number of events is only known at the end (streams
+    /// and files in follow mode)
+    bool eventsKnown() const;
+
+    /// Follow mode is taken from the config, this allows turning it off
+    /// for files known to be complete
+    void setFollow(bool follow);
+
+    /// Walks the file reading only the event headers and fills the
+    /// index. Returns the number of selected events.
+    /// If index files are enabled, the index is taken from the sidecar
+    /// file (<filename>.idx) when it matches the data file, or written
+    /// there after the scan otherwise.
+    int buildIndex();
+
+    /// Loads the next selected event of the index and returns its event
+    /// number (-1 at the end of the file). The buffer points to the full
+    /// super event and must be given back with releaseEvent.
+    /// With read_ahead > 0 the following events are read in the
+    /// background while the current one is decoded: a thread fills a
+    /// queue of read_ahead events in stdio mode, the kernel is asked to
+    /// page them in (MADV_WILLNEED) in mmap mode.
+    /// In follow mode (file still being written by the DAQ) it waits for
+    /// new events to be appended, see waitForEvents.
+    int loadNextEvent(unsigned char ** buffer);
+    void releaseEvent(unsigned char * buffer);
+
+    /// Reads a big event piece by piece instead of in a single buffer.
+    /// loadNextEventHeader copies the header of the next selected event
+    /// and returns its event number (-1 at the end of the file), then
+    /// readEventPart copies size bytes starting at byte pos of the event
+    /// and finishEvent moves past it. In stream mode the parts have to be
+    /// read in increasing order of pos.
+    int loadNextEventHeader(eventHeaderStruct * header);
+    bool readEventPart(uint64_t pos, size_t size, unsigned char * buffer);
+    void finishEvent();
+
+    /// Moves past the next selected event without reading it.
+    /// Returns its event number (-1 at the end of the file).
+    int skipEvent();
+
+    /// Event number of the next selected event, without reading it.
+    /// Returns -1 at the end of the file. In follow mode it may wait and
+    /// remap the file, so events handed out must have been released.
+    int peekEvent();
+
+    /// Places the file so the next loadNextEvent returns event nbInRun.
+    /// Returns false if the event is not in this file.
+    bool seekEvent(int nbInRun);
+
+    /// Places the file on its first selected event numbered nbInRun or
+    /// later. Returns that number, -1 if there is none.
+    int seekEventFrom(int nbInRun);
+
+    std::string const & filename() const;
+    InputMode mode() const;
+    std::vector<EventIndexEntry> const & index() const;
+    int selectedEvents() const;
+    int firstEvent() const;
+
+  private:
+    void addIndexEntry(EventIndexEntry const & entry);
+    std::vector<size_t>::const_iterator firstSelectedFrom(int nbInRun) const;
+    void scanHeaders();
+    bool readHeader(uint64_t offset, eventHeaderStruct * header) const;
+    bool validEventAt(uint64_t offset, uint64_t fileSize) const;
+    uint64_t findNextEvent(uint64_t offset, uint64_t fileSize) const;
+    bool resyncStream(eventHeaderStruct * header);
+    void truncatedEvent(uint64_t offset);
+    bool remap(size_t size);
+    bool openStream();
+    bool openBlocks();
+    bool loadBlock(uint64_t start);
+    bool readBlocks(uint64_t offset, size_t size, unsigned char * buffer);
+    bool readFully(unsigned char * buffer, size_t size);
+    unsigned char * readStreamEvent();
+    bool readStreamHeader(eventHeaderStruct * header);
+    bool skipStream(uint64_t size);
+    bool waitForEvents();
+    bool statFile(struct stat * st) const;
+    bool readIndexFile();
+    bool sameHeaderAt(uint64_t offset, eventHeaderStruct const & expected) const;
+    void writeIndexFile() const;
+    size_t nextSelected(size_t pos) const;
+    bool readEntry(EventIndexEntry const & entry, unsigned char * buffer);
+    void willNeed(size_t pos);
+    void startPrefetch();
+    void stopPrefetch();
+    void prefetchLoop();
+    bool popPrefetched(PrefetchedEvent * event);
+
+    std::string filename_;
+    std::string indexFilename_;
+    InputMode mode_;
+    bool useIndexFile_;
+    bool follow_;
+    int followTimeout_; // Seconds without new events before giving up
+
+    std::FILE* fptr_;
+    uint64_t filePos_; // Current position of fptr_, or bytes read from a stream
+
+    std::vector<EventIndexEntry> index_;
+    std::vector<size_t> selectedIndex_; // Positions in index_ of the selected events
+    size_t next_;    // Next entry of the index to be loaded
+    int selected_;   // Number of PHYSICS & CALIBRATION events in the index
+    int firstEvent_; // Event number of the first selected event
+    uint64_t scanEnd_; // End of the last complete event in the index
+    bool endOfRun_;    // END_OF_RUN event found
+
+    // mmap mode
+    int fd_;
+    unsigned char * map_;
+    size_t mapSize_;
+    size_t released_; // Data before this offset has been given back (mmap and block modes)
+    size_t advised_;  // Mapping before this offset has been requested with MADV_WILLNEED
+
+    // block mode, fptr_ reads the headers and fd_ the blocks
+    size_t blockSize_;
+    bool directIO_;
+    unsigned char * block_;
+    uint64_t blockStart_; // Position of block_ in the file
+    size_t blockBytes_;   // Bytes read into block_
+
+    // read-ahead
+    size_t readAhead_; // Queue depth, 0 to read synchronously
+    std::thread prefetchThread_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::deque<PrefetchedEvent> queue_;
+    size_t prefetchNext_; // Next entry of the index to be read by the thread
+    bool prefetching_;
+    bool prefetchDone_;
+    bool stopPrefetch_;
+
+    BufferPool * pool_;
+    BufferPool * ownPool_;
+
+    // stream mode
+    unsigned char * peeked_; // Event read by peekEvent, not handed out yet
+    Decompressor * decompressor_; // Compressed files, fd_ reads its output
+    std::vector<unsigned char> unread_; // Read while resynchronising, given out before reading fd_ again
+
+    // event read by parts
+    uint64_t partialOffset_; // Position of the event in the file
+    uint64_t partialSize_;   // eventSize
+    uint64_t partialRead_;   // Bytes of the event already read from a stream
+    unsigned char * partialBuffer_; // Event already in memory (mmap or peeked), NULL otherwise
+
+    std::shared_ptr<spdlog::logger> _log;
+  }; //class DATEFile
+
+  // INLINE METHODS //////////////////////////////////////////////////
+
+  inline std::string const & DATEFile::filename() const {return filename_;}
+  inline InputMode DATEFile::mode() const {return mode_;}
+  inline bool DATEFile::isOpen() const {return fptr_ != NULL || fd_ >= 0;}
+  inline void DATEFile::setFollow(bool follow) {follow_ = follow;}
+  inline bool DATEFile::eventsKnown() const {return !follow_ && mode_ != InputMode::stream;}
+  inline std::vector<EventIndexEntry> const & DATEFile::index() const {return index_;}
+  inline int DATEFile::selectedEvents() const {return selected_;}
+  inline int DATEFile::firstEvent() const {return firstEvent_;}
+
+}
+
+bool isEventSelected(eventHeaderStruct const & event);
+
+/// Position of the first EVENT_MAGIC_NUMBER word, as stored in the
+/// files, in data. Returns size if there is none.
+size_t findEventMagic(unsigned char const * data, size_t size);
@@ -0,0 +1,196 @@
+#include "detail/DATEMerger.h"
+
+namespace spd = spdlog;
+
+next::DATEMerger::DATEMerger(ReadConfig * config) :
+	pool_(config->hugePages()),
+	heapValid_(false),
+	pending_(-1),
+	seeked_(-1),
+	current_(0),
+	lastEvent_(-1)
+{
+	// This declaration avoid errors when creating more than one merger
+	static auto log = spd::stdout_color_mt("datemerger");
+	_log = log;
+}
+
+next::DATEMerger::~DATEMerger(){
+	for (auto stream : streams_){
+		delete stream;
+	}
+}
+
+void next::DATEMerger::addStream(DATEStream * stream){
+	streams_.push_back(stream);
+	heapValid_ = false;
+}
+
+int next::DATEMerger::buildIndex(){
+	int selected = 0;
+	for (auto stream : streams_){
+		selected += stream->buildIndex();
+	}
+	heapValid_ = false;
+	lastEvent_ = -1;
+	return selected;
+}
+
+int next::DATEMerger::firstEvent() const{
+	int first = -1;
+	for (auto stream : streams_){
+		int evt = stream->firstEvent();
+		if (evt >= 0 && (first < 0 || evt < first)){
+			first = evt;
+		}
+	}
+	return first;
+}
+
+bool next::DATEMerger::eventsKnown() const{
+	for (auto stream : streams_){
+		if (!stream->eventsKnown()){
+			return false;
+		}
+	}
+	return true;
+}
+
+void next::DATEMerger::pushStream(size_t stream){
+	int evt_number = streams_[stream]->peekEvent();
+	if (evt_number >= 0){
+		heap_.push(HeapEntry(evt_number, stream));
+	}
+}
+
+// Returns the stream holding the next event, -1 if all of them are
+// finished. Duplicated events are dropped here without reading them.
+int next::DATEMerger::nextStream(){
+	if (!heapValid_){
+		heap_ = decltype(heap_)();
+		for (size_t i=0; i<streams_.size(); i++){
+			pushStream(i);
+		}
+		heapValid_ = true;
+		pending_ = -1;
+	}
+	// Peeking may remap a file in follow mode, so it is done once the
+	// previous event has been released
+	if (pending_ >= 0){
+		pushStream(pending_);
+		pending_ = -1;
+	}
+
+	while (!heap_.empty()){
+		HeapEntry top = heap_.top();
+		if (top.first != lastEvent_){
+			return top.second;
+		}
+		heap_.pop();
+		_log->warn("Event {} duplicated in {}, ignored", top.first, streams_[top.second]->filenames()[0]);
+		streams_[top.second]->skipEvent();
+		pushStream(top.second);
+	}
+	return -1;
+}
+
+void next::DATEMerger::checkSequence(int nbInRun, size_t stream){
+	// Nothing was read, the last event handed out is still the same
+	if (nbInRun < 0){
+		return;
+	}
+	if (lastEvent_ >= 0){
+		if (nbInRun > lastEvent_ + 1){
+			if (nbInRun == lastEvent_ + 2){
+				_log->warn("Event {} missing", lastEvent_ + 1);
+			}else{
+				_log->warn("Events {} to {} missing", lastEvent_ + 1, nbInRun - 1);
+			}
+		}else if (nbInRun < lastEvent_){
+			_log->warn("Event {} out of order in {}, after event {}", nbInRun, streams_[stream]->filenames()[0], lastEvent_);
+		}
+	}
+	lastEvent_ = nbInRun;
+}
+
+// Takes out of the heap the stream of the next event, or the one placed
+// by seekEvent. Returns false if all the streams are finished.
+bool next::DATEMerger::selectStream(){
+	if (seeked_ >= 0){
+		current_ = seeked_;
+		seeked_  = -1;
+		return true;
+	}
+
+	int stream = nextStream();
+	if (stream < 0){
+		return false;
+	}
+	heap_.pop();
+	current_ = stream;
+	pending_ = stream;
+	return true;
+}
+
+int next::DATEMerger::loadNextEvent(unsigned char ** buffer){
+	if (!selectStream()){
+		return -1;
+	}
+	int evt_number = streams_[current_]->loadNextEvent(buffer);
+	checkSequence(evt_number, current_);
+	return evt_number;
+}
+
+void next::DATEMerger::releaseEvent(unsigned char * buffer){
+	streams_[current_]->releaseEvent(buffer);
+}
+
+int next::DATEMerger::loadNextEventHeader(eventHeaderStruct * header){
+	if (!selectStream()){
+		return -1;
+	}
+	int evt_number = streams_[current_]->loadNextEventHeader(header);
+	checkSequence(evt_number, current_);
+	return evt_number;
+}
+
+bool next::DATEMerger::readEventPart(uint64_t pos, size_t size, unsigned char * buffer){
+	return streams_[current_]->readEventPart(pos, size, buffer);
+}
+
+void next::DATEMerger::finishEvent(){
+	streams_[current_]->finishEvent();
+}
+
+int next::DATEMerger::skipEvent(){
+	int stream = nextStream();
+	if (stream < 0){
+		return -1;
+	}
+	heap_.pop();
+	pending_ = stream;
+
+	int evt_number = streams_[stream]->skipEvent();
+	checkSequence(evt_number, stream);
+	return evt_number;
+}
+
+// The following loadNextEvent returns the event. The other streams are
+// placed on their first event after it, so the merged reading goes on
+// from there and their copies of the event are dropped.
+bool next::DATEMerger::seekEvent(int nbInRun){
+	for (size_t i=0; i<streams_.size(); i++){
+		if (streams_[i]->seekEvent(nbInRun)){
+			for (size_t j=0; j<streams_.size(); j++){
+				if (j != i){
+					streams_[j]->seekEventFrom(nbInRun + 1);
+				}
+			}
+			seeked_    = i;
+			heapValid_ = false;
+			lastEvent_ = -1;
+			return true;
+		}
+	}
+	return false;
+}
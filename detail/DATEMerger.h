@@ -0,0 +1,77 @@
+#ifndef _DATEMERGER
+#define _DATEMERGER
+#endif
+
+#ifndef _DATESTREAM
+#include "detail/DATEStream.h"
+#endif
+
+#include <functional>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace next {
+
+  /// DATEMerger reads the events of all the GDCs of a run ordered by
+  /// event number. Each GDC is a DATEStream; a min-heap keyed on the
+  /// next event number of each stream tells which one goes next.
+  /// Missing event numbers are reported, duplicated ones are reported
+  /// and only the first copy is returned.
+
+  class DATEMerger
+  {
+  public:
+    DATEMerger(ReadConfig * config);
+    ~DATEMerger();
+
+    /// The merger takes ownership of the stream
+    void addStream(DATEStream * stream);
+
+    /// Indexes all the streams. Returns the number of selected events.
+    int buildIndex();
+
+    /// Same as in DATEFile, taking the event from the right stream
+    int loadNextEvent(unsigned char ** buffer);
+    void releaseEvent(unsigned char * buffer);
+    int skipEvent();
+    bool seekEvent(int nbInRun);
+
+    /// Same as in DATEFile, for events read by parts
+    int loadNextEventHeader(eventHeaderStruct * header);
+    bool readEventPart(uint64_t pos, size_t size, unsigned char * buffer);
+    void finishEvent();
+
+    std::vector<DATEStream*> const & streams() const;
+    int firstEvent() const;
+    bool eventsKnown() const;
+
+    /// Buffers for the events of all the streams
+    BufferPool * bufferPool();
+
+  private:
+    typedef std::pair<int, size_t> HeapEntry; // (event number, stream)
+
+    int nextStream();
+    bool selectStream();
+    void pushStream(size_t stream);
+    void checkSequence(int nbInRun, size_t stream);
+
+    std::vector<DATEStream*> streams_;
+    BufferPool pool_;
+    std::priority_queue<HeapEntry, std::vector<HeapEntry>, std::greater<HeapEntry> > heap_;
+    bool heapValid_;
+    int pending_;   // Stream to put back in the heap once its event is released
+    int seeked_;    // Stream placed by seekEvent
+    size_t current_; // Stream of the last event handed out
+    int lastEvent_;  // Last event number handed out, -1 if none
+
+    std::shared_ptr<spdlog::logger> _log;
+  }; //class DATEMerger
+
+  // INLINE METHODS //////////////////////////////////////////////////
+
+  inline std::vector<DATEStream*> const & DATEMerger::streams() const {return streams_;}
+  inline BufferPool * DATEMerger::bufferPool() {return &pool_;}
+
+}
@@ -0,0 +1,325 @@
+#include "detail/DATEStream.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <glob.h>
+#include <map>
+#include <regex>
+#include <sys/stat.h>
+
+namespace spd = spdlog;
+
+next::DATEStream::DATEStream(std::vector<std::string> const & filenames, ReadConfig * config, BufferPool * pool) :
+	filenames_(filenames),
+	current_(0),
+	selected_(0),
+	firstEvent_(-1)
+{
+	// This declaration avoid errors when creating more than one stream
+	static auto log = spd::stdout_color_mt("datestream");
+	_log = log;
+
+	for (size_t i=0; i<filenames_.size(); i++){
+		DATEFile * chunk = new DATEFile(filenames_[i], config, pool);
+		// Only the last chunk can still be growing
+		if (i + 1 < filenames_.size()){
+			chunk->setFollow(false);
+		}
+		chunks_.push_back(chunk);
+	}
+}
+
+next::DATEStream::~DATEStream(){
+	for (auto chunk : chunks_){
+		delete chunk;
+	}
+}
+
+bool next::DATEStream::open(){
+	current_ = 0;
+	return !chunks_.empty() && chunks_[0]->open();
+}
+
+void next::DATEStream::close(){
+	if (current_ < chunks_.size()){
+		chunks_[current_]->close();
+	}
+}
+
+bool next::DATEStream::openChunk(size_t chunk){
+	if (chunks_[chunk]->isOpen()){
+		return true;
+	}
+	if (!chunks_[chunk]->open()){
+		_log->error("Unable to open specified DATE file {}", filenames_[chunk]);
+		return false;
+	}
+	return true;
+}
+
+bool next::DATEStream::eventsKnown() const{
+	for (auto chunk : chunks_){
+		if (!chunk->eventsKnown()){
+			return false;
+		}
+	}
+	return true;
+}
+
+// Current chunk finished, go on with the next one
+void next::DATEStream::nextChunk(){
+	chunks_[current_]->close();
+	current_++;
+	if (current_ < chunks_.size()){
+		openChunk(current_);
+	}
+}
+
+// Chunks other than the current one are opened just to build their
+// index, which is kept after closing them
+int next::DATEStream::buildIndex(){
+	selected_   = 0;
+	firstEvent_ = -1;
+	for (size_t i=0; i<chunks_.size(); i++){
+		if (!openChunk(i)){
+			continue;
+		}
+		int selected = chunks_[i]->buildIndex();
+		if (selected && firstEvent_ < 0){
+			firstEvent_ = chunks_[i]->firstEvent();
+		}
+		selected_ += selected;
+		if (i != current_){
+			chunks_[i]->close();
+		}
+		_log->debug("{}: {} events", filenames_[i], selected);
+	}
+	return selected_;
+}
+
+int next::DATEStream::loadNextEvent(unsigned char ** buffer){
+	while (current_ < chunks_.size()){
+		int evt_number = chunks_[current_]->loadNextEvent(buffer);
+		if (evt_number >= 0){
+			return evt_number;
+		}
+		nextChunk();
+	}
+	return -1;
+}
+
+void next::DATEStream::releaseEvent(unsigned char * buffer){
+	chunks_[current_]->releaseEvent(buffer);
+}
+
+int next::DATEStream::loadNextEventHeader(eventHeaderStruct * header){
+	while (current_ < chunks_.size()){
+		int evt_number = chunks_[current_]->loadNextEventHeader(header);
+		if (evt_number >= 0){
+			return evt_number;
+		}
+		nextChunk();
+	}
+	return -1;
+}
+
+bool next::DATEStream::readEventPart(uint64_t pos, size_t size, unsigned char * buffer){
+	return chunks_[current_]->readEventPart(pos, size, buffer);
+}
+
+void next::DATEStream::finishEvent(){
+	chunks_[current_]->finishEvent();
+}
+
+int next::DATEStream::skipEvent(){
+	while (current_ < chunks_.size()){
+		int evt_number = chunks_[current_]->skipEvent();
+		if (evt_number >= 0){
+			return evt_number;
+		}
+		nextChunk();
+	}
+	return -1;
+}
+
+int next::DATEStream::peekEvent(){
+	while (current_ < chunks_.size()){
+		int evt_number = chunks_[current_]->peekEvent();
+		if (evt_number >= 0){
+			return evt_number;
+		}
+		nextChunk();
+	}
+	return -1;
+}
+
+// Indexed chunks are searched through their index, wherever they are.
+// Chunks read as streams (compressed ones, stream mode) only know the
+// events already read, so they are walked forward from the current
+// one: the events skipped are lost, and so are the chunks left behind.
+bool next::DATEStream::seekEvent(int nbInRun){
+	for (size_t i=0; i<chunks_.size(); i++){
+		if (chunks_[i]->mode() != InputMode::stream && chunks_[i]->seekEvent(nbInRun)){
+			if (i != current_){
+				close();
+				current_ = i;
+			}
+			// The chunks after it may have been left halfway by an earlier seek
+			for (size_t j=i+1; j<chunks_.size(); j++){
+				if (chunks_[j]->mode() != InputMode::stream && chunks_[j]->selectedEvents()){
+					chunks_[j]->seekEvent(chunks_[j]->firstEvent());
+				}
+			}
+			return openChunk(i);
+		}
+	}
+
+	while (current_ < chunks_.size() && chunks_[current_]->mode() == InputMode::stream){
+		if (chunks_[current_]->seekEvent(nbInRun)){
+			return true;
+		}
+		// Stopped at a later event, the chunks after it come later too
+		if (chunks_[current_]->peekEvent() >= 0){
+			return false;
+		}
+		nextChunk();
+	}
+	return false;
+}
+
+// Same search as seekEvent for the first event numbered nbInRun or
+// later. With none left, the last chunk is kept current as in follow
+// mode it may still grow.
+int next::DATEStream::seekEventFrom(int nbInRun){
+	for (size_t i=0; i<chunks_.size(); i++){
+		if (chunks_[i]->mode() == InputMode::stream){
+			continue;
+		}
+		int evt_number = chunks_[i]->seekEventFrom(nbInRun);
+		if (evt_number >= 0){
+			if (i != current_){
+				close();
+				current_ = i;
+			}
+			for (size_t j=i+1; j<chunks_.size(); j++){
+				if (chunks_[j]->mode() != InputMode::stream && chunks_[j]->selectedEvents()){
+					chunks_[j]->seekEvent(chunks_[j]->firstEvent());
+				}
+			}
+			return openChunk(i) ? evt_number : -1;
+		}
+	}
+
+	while (current_ < chunks_.size()){
+		int evt_number = chunks_[current_]->seekEventFrom(nbInRun);
+		if (evt_number >= 0 || current_ + 1 == chunks_.size()){
+			return evt_number;
+		}
+		nextChunk();
+	}
+	return -1;
+}
+
+// Chunk number of run_XXXX.gdcNnext.CCC.rd(.gz|.zst), 0 if there is none
+static int chunkNumber(std::string const & filename){
+	static const std::regex chunk("\\.([0-9]+)\\.rd(\\.gz|\\.zst)?$");
+	std::smatch match;
+	if (std::regex_search(filename, match, chunk)){
+		return std::atoi(match[1].str().c_str());
+	}
+	return 0;
+}
+
+// Plain, gzip or zstd compressed DATE file
+static bool isRunFile(std::string const & filename){
+	static const std::regex runFile("\\.rd(\\.gz|\\.zst)?$");
+	return std::regex_search(filename, runFile);
+}
+
+// Run number of run_XXXX.gdcNnext..., -1 if there is none
+static int runNumber(std::string const & filename){
+	static const std::regex run("run_([0-9]+)");
+	std::smatch match;
+	if (std::regex_search(filename, match, run)){
+		return std::atoi(match[1].str().c_str());
+	}
+	return -1;
+}
+
+// Name of the plain file of a compressed one
+static std::string plainName(std::string const & filename){
+	static const std::regex compressed("(\\.gz|\\.zst)$");
+	return std::regex_replace(filename, compressed, "");
+}
+
+std::vector<std::vector<std::string> > next::findRunFiles(std::string const & input, bool twoFiles){
+	std::vector<std::vector<std::string> > files;
+
+	struct stat st;
+	bool isDir  = stat(input.c_str(), &st) == 0 && S_ISDIR(st.st_mode);
+	bool isGlob = input.find_first_of("*?[") != std::string::npos;
+	if (!isDir && !isGlob){
+		// Just one file, it may not exist yet in follow mode
+		files.push_back(std::vector<std::string>(1, input));
+		size_t gdc1 = input.rfind("gdc1");
+		if (twoFiles && gdc1 != std::string::npos){
+			std::string input2 = input;
+			input2.replace(gdc1, 4, "gdc2");
+			files.push_back(std::vector<std::string>(1, input2));
+		}
+		return files;
+	}
+
+	std::string pattern = isDir ? input + "/*.rd*" : input;
+	glob_t paths;
+	if (glob(pattern.c_str(), 0, NULL, &paths)){
+		globfree(&paths);
+		return files;
+	}
+
+	static const std::regex gdcName("gdc([0-9]+)");
+	// gdc -> plain name of each chunk -> file read for it
+	std::map<int, std::map<std::string, std::string> > gdcs;
+	int run = -1;
+	for (size_t i=0; i<paths.gl_pathc; i++){
+		std::string path = paths.gl_pathv[i];
+		std::string name = path.substr(path.rfind('/') + 1);
+		// Sidecar files (.rd.idx, .tmp) also match wide patterns
+		if (!isRunFile(name)){
+			continue;
+		}
+		std::smatch match;
+		// Not written by a GDC (e.g. output of copy_evts)
+		if (!std::regex_search(name, match, gdcName)){
+			continue;
+		}
+		// Only the run of the first file, a directory may hold several
+		if (gdcs.empty()){
+			run = runNumber(name);
+		}else if (runNumber(name) != run){
+			continue;
+		}
+		int gdc = std::atoi(match[1].str().c_str());
+		// A chunk both plain and compressed is read once, from the plain
+		// file which can be indexed
+		auto chunk = gdcs[gdc].insert(std::make_pair(plainName(path), path));
+		if (!chunk.second && plainName(path) == path){
+			chunk.first->second = path;
+		}
+	}
+	globfree(&paths);
+
+	for (auto const & gdc : gdcs){
+		std::vector<std::pair<int, std::string> > sorted;
+		for (auto const & chunk : gdc.second){
+			sorted.push_back(std::make_pair(chunkNumber(chunk.second), chunk.second));
+		}
+		std::sort(sorted.begin(), sorted.end());
+		std::vector<std::string> chunks;
+		for (auto const & chunk : sorted){
+			chunks.push_back(chunk.second);
+		}
+		files.push_back(chunks);
+	}
+	return files;
+}
@@ -0,0 +1,81 @@
+#ifndef _DATESTREAM
+#define _DATESTREAM
+#endif
+
+#ifndef _DATEFILE
+#include "detail/DATEFile.h"
+#endif
+
+#include <string>
+#include <vector>
+
+namespace next {
+
+  /// DATEStream chains the chunks written by one GDC for a run
+  /// (run_XXXX.gdcNnext.000.rd, .001.rd, ...) so they are read as a
+  /// single sequence of events. Only the chunk being read is kept open.
+  /// In follow mode only the last chunk is followed: the chunks are
+  /// those found at start-up, a new chunk started by the DAQ afterwards
+  /// is not read.
+
+  class DATEStream
+  {
+  public:
+    DATEStream(std::vector<std::string> const & filenames, ReadConfig * config, BufferPool * pool = NULL);
+    ~DATEStream();
+
+    /// Returns false if the first chunk cannot be opened
+    bool open();
+    void close();
+
+    /// Indexes all the chunks. Returns the number of selected events.
+    int buildIndex();
+
+    /// Same as in DATEFile, moving to the next chunk when the current
+    /// one is finished
+    int loadNextEvent(unsigned char ** buffer);
+    void releaseEvent(unsigned char * buffer);
+    int loadNextEventHeader(eventHeaderStruct * header);
+    bool readEventPart(uint64_t pos, size_t size, unsigned char * buffer);
+    void finishEvent();
+    int skipEvent();
+    int peekEvent();
+    bool seekEvent(int nbInRun);
+    int seekEventFrom(int nbInRun);
+
+    std::vector<std::string> const & filenames() const;
+    int selectedEvents() const;
+    int firstEvent() const;
+    bool eventsKnown() const;
+
+  private:
+    bool openChunk(size_t chunk);
+    void nextChunk();
+
+    std::vector<std::string> filenames_;
+    std::vector<DATEFile*> chunks_;
+    size_t current_; // Chunk being read
+    int selected_;
+    int firstEvent_;
+
+    std::shared_ptr<spdlog::logger> _log;
+  }; //class DATEStream
+
+  // INLINE METHODS //////////////////////////////////////////////////
+
+  inline std::vector<std::string> const & DATEStream::filenames() const {return filenames_;}
+  inline int DATEStream::selectedEvents() const {return selected_;}
+  inline int DATEStream::firstEvent() const {return firstEvent_;}
+
+  /// Finds the files of a run. input can be a single file, a directory
+  /// or a glob pattern. Files are grouped by GDC (gdcN in the name) and
+  /// sorted by chunk number. Returns one list of files per GDC, ordered
+  /// by GDC number.
+  /// Only the files of the run (run_N in the name) of the first file
+  /// found are taken. A chunk found both plain and compressed is taken
+  /// once, the plain file.
+  /// For a single gdc1 file and twoFiles, the gdc2 file name is derived
+  /// from it. If nothing matches input is returned as is.
+  std::vector<std::vector<std::string> > findRunFiles(std::string const & input, bool twoFiles);
+
+}
@@ -0,0 +1,170 @@
+#include "detail/Decompressor.h"
+
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+#ifdef ZSTD
+#include <zstd.h>
+#endif
+
+namespace spd = spdlog;
+
+static const size_t CHUNK_SIZE = 1 << 20;
+
+next::Compression next::detectCompression(std::string const & filename){
+	struct stat st;
+	if (stat(filename.c_str(), &st) || !S_ISREG(st.st_mode)){
+		return Compression::none;
+	}
+
+	unsigned char magic[4] = {0, 0, 0, 0};
+	std::FILE * file = std::fopen(filename.c_str(), "rb");
+	if (!file){
+		return Compression::none;
+	}
+	size_t bytes = fread(magic, 1, sizeof(magic), file);
+	std::fclose(file);
+
+	if (bytes >= 2 && magic[0] == 0x1f && magic[1] == 0x8b){
+		return Compression::gzip;
+	}
+	if (bytes == 4 && magic[0] == 0x28 && magic[1] == 0xb5 && magic[2] == 0x2f && magic[3] == 0xfd){
+		return Compression::zstd;
+	}
+	return Compression::none;
+}
+
+next::Decompressor::Decompressor(std::string const & filename, Compression compression) :
+	filename_(filename),
+	compression_(compression)
+{
+	fds_[0] = -1;
+	fds_[1] = -1;
+	// This declaration avoid errors when creating more than one decompressor
+	static auto log = spd::stdout_color_mt("decompressor");
+	_log = log;
+}
+
+// Closing the read end makes the pending write fail, so the thread ends
+// even if the reader stopped early
+next::Decompressor::~Decompressor(){
+	if (fds_[0] >= 0){
+		shutdown(fds_[0], SHUT_RDWR);
+		close(fds_[0]);
+	}
+	if (thread_.joinable()){
+		thread_.join();
+	}
+}
+
+// A socket pair is used instead of a pipe: with MSG_NOSIGNAL writing
+// after the reader is gone gives an error instead of SIGPIPE
+int next::Decompressor::start(){
+#ifndef ZSTD
+	if (compression_ == Compression::zstd){
+		_log->error("{} is zstd compressed but zstd support was not built (make ZSTD=1)", filename_);
+		return -1;
+	}
+#endif
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds_)){
+		_log->error("Unable to create the decompression socket for {}", filename_);
+		return -1;
+	}
+	thread_ = std::thread(&next::Decompressor::run, this);
+	return fds_[0];
+}
+
+void next::Decompressor::run(){
+	if (compression_ == Compression::gzip){
+		gzip();
+	}else{
+		zstd();
+	}
+	// End of data for the reader
+	close(fds_[1]);
+	fds_[1] = -1;
+}
+
+bool next::Decompressor::write(char const * buffer, size_t size){
+	size_t done = 0;
+	while (done < size){
+		ssize_t bytes = send(fds_[1], buffer + done, size - done, MSG_NOSIGNAL);
+		if (bytes < 0 && errno == EINTR){
+			continue;
+		}
+		if (bytes <= 0){
+			return false;
+		}
+		done += bytes;
+	}
+	return true;
+}
+
+// gzread also takes care of files made of several gzip members
+void next::Decompressor::gzip(){
+	gzFile file = gzopen(filename_.c_str(), "rb");
+	if (!file){
+		_log->error("Unable to open {}", filename_);
+		return;
+	}
+	gzbuffer(file, CHUNK_SIZE);
+
+	std::vector<char> buffer(CHUNK_SIZE);
+	int bytes;
+	while ((bytes = gzread(file, buffer.data(), buffer.size())) > 0){
+		if (!write(buffer.data(), bytes)){
+			break;
+		}
+	}
+	if (bytes < 0){
+		int error;
+		_log->error("Error decompressing {}: {}", filename_, gzerror(file, &error));
+	}
+	gzclose(file);
+}
+
+void next::Decompressor::zstd(){
+#ifdef ZSTD
+	std::FILE * file = std::fopen(filename_.c_str(), "rb");
+	if (!file){
+		_log->error("Unable to open {}", filename_);
+		return;
+	}
+
+	ZSTD_DStream * stream = ZSTD_createDStream();
+	ZSTD_initDStream(stream);
+	std::vector<char> in(ZSTD_DStreamInSize());
+	std::vector<char> out(ZSTD_DStreamOutSize());
+
+	// last is 0 once a frame has been fully decoded and flushed
+	bool ok = true;
+	size_t bytes;
+	size_t last = 0;
+	while (ok && (bytes = fread(in.data(), 1, in.size(), file)) > 0){
+		ZSTD_inBuffer input = {in.data(), bytes, 0};
+		bool full = false; // Output left inside the stream
+		while (ok && (input.pos < input.size || full)){
+			ZSTD_outBuffer output = {out.data(), out.size(), 0};
+			last = ZSTD_decompressStream(stream, &output, &input);
+			if (ZSTD_isError(last)){
+				_log->error("Error decompressing {}: {}", filename_, ZSTD_getErrorName(last));
+				ok = false;
+			}else{
+				ok = write(out.data(), output.pos);
+				full = output.pos == output.size;
+			}
+		}
+	}
+	if (ok && last != 0){
+		_log->error("Truncated zstd frame at the end of {}", filename_);
+	}
+
+	ZSTD_freeDStream(stream);
+	std::fclose(file);
+#endif
+}
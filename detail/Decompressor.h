@@ -0,0 +1,50 @@
+#ifndef _DECOMPRESSOR
+#define _DECOMPRESSOR
+#endif
+
+#ifndef SPDLOG_VERSION
+#include "spdlog/spdlog.h"
+#endif
+
+#include <string>
+#include <thread>
+
+namespace next {
+
+  enum class Compression { none, gzip, zstd };
+
+  /// Looks at the magic number of the file. stdin, FIFOs and sockets
+  /// are never reported as compressed.
+  Compression detectCompression(std::string const & filename);
+
+  /// Decompressor inflates a gzip or zstd file in a background thread.
+  /// The decompressed data is read from the descriptor returned by
+  /// start(), so DATEFile reads it in stream mode without temporary
+  /// files.
+  /// zstd is only available when built with -DZSTD (make ZSTD=1).
+
+  class Decompressor
+  {
+  public:
+    Decompressor(std::string const & filename, Compression compression);
+    /// Stops the thread even if the data has not been read
+    ~Decompressor();
+
+    /// Returns the descriptor to read from, -1 on error
+    int start();
+
+  private:
+    void run();
+    bool write(char const * buffer, size_t size);
+    void gzip();
+    void zstd();
+
+    std::string filename_;
+    Compression compression_;
+    int fds_[2]; // read end, write end
+    std::thread thread_;
+
+    std::shared_ptr<spdlog::logger> _log;
+  }; //class Decompressor
+
+}
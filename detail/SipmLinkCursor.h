@@ -0,0 +1,51 @@
+#ifndef _SIPMLINKCURSOR
+#define _SIPMLINKCURSOR
+#endif
+
+#include <cstddef>
+#include <stdint.h>
+
+namespace next {
+
+  /// SipmLinkCursor reads the two links of a SiPM FEC pair as the
+  /// interleaved payload (even words from link A, odd words from link B)
+  /// without building it. It supports the pointer operations the SiPM
+  /// decoders use. Words past the end of the links read as 0xFFFF, the
+  /// end of data mark.
+
+  class SipmLinkCursor
+  {
+  public:
+    SipmLinkCursor(int16_t const * linkA, int16_t const * linkB, size_t size) :
+      pos_(0), end_(2*size)
+    {
+      links_[0] = linkA;
+      links_[1] = linkB;
+    }
+
+    int16_t operator*() const { return (*this)[0]; }
+
+    int16_t operator[](ptrdiff_t i) const
+    {
+      size_t pos = pos_ + i;
+      if(pos >= end_){
+        return -1;
+      }
+      return links_[pos & 1][pos >> 1];
+    }
+
+    SipmLinkCursor & operator++() { pos_++; return *this; }
+    SipmLinkCursor operator++(int) { SipmLinkCursor old = *this; pos_++; return old; }
+    SipmLinkCursor & operator+=(ptrdiff_t n) { pos_ += n; return *this; }
+    SipmLinkCursor operator+(ptrdiff_t n) const { SipmLinkCursor c = *this; c.pos_ += n; return c; }
+
+    /// Words of the interleaved payload already walked
+    size_t position() const { return pos_; }
+
+  private:
+    int16_t const * links_[2];
+    size_t pos_;
+    size_t end_;
+  }; //class SipmLinkCursor
+
+}
@@ -0,0 +1,73 @@
+#include "detail/ThreadPool.h"
+
+next::ThreadPool::ThreadPool(int threads) :
+	task_(NULL),
+	tasks_(0),
+	next_(0),
+	pending_(0),
+	stop_(false)
+{
+	for (int i=1; i<threads; i++){
+		workers_.emplace_back(&next::ThreadPool::work, this);
+	}
+}
+
+next::ThreadPool::~ThreadPool(){
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		stop_ = true;
+	}
+	wake_.notify_all();
+	for (auto & worker : workers_){
+		worker.join();
+	}
+}
+
+int next::ThreadPool::threads() const{
+	return workers_.size() + 1;
+}
+
+void next::ThreadPool::run(int tasks, std::function<void(int)> const & task){
+	if (tasks <= 0){
+		return;
+	}
+	std::unique_lock<std::mutex> lock(mutex_);
+	task_    = &task;
+	tasks_   = tasks;
+	next_    = 0;
+	pending_ = tasks;
+	wake_.notify_all();
+
+	while (runNext(lock)){
+	}
+	done_.wait(lock, [this]{ return pending_ == 0; });
+	task_ = NULL;
+}
+
+// Runs one task of the current run without holding the lock, false if
+// there were none left to start
+bool next::ThreadPool::runNext(std::unique_lock<std::mutex> & lock){
+	if (!task_ || next_ >= tasks_){
+		return false;
+	}
+	int index = next_++;
+	std::function<void(int)> const & task = *task_;
+	lock.unlock();
+	task(index);
+	lock.lock();
+	if (--pending_ == 0){
+		done_.notify_all();
+	}
+	return true;
+}
+
+void next::ThreadPool::work(){
+	std::unique_lock<std::mutex> lock(mutex_);
+	while (true){
+		wake_.wait(lock, [this]{ return stop_ || (task_ && next_ < tasks_); });
+		if (stop_){
+			return;
+		}
+		runNext(lock);
+	}
+}
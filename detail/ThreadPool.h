@@ -0,0 +1,45 @@
+#ifndef _THREADPOOL
+#define _THREADPOOL
+#endif
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace next {
+
+  /// ThreadPool runs the parts of a decoding step at the same time. The
+  /// threads are started once and wait between calls to run(); the
+  /// calling thread takes parts too, so a pool of n threads starts n-1.
+  /// run() is not reentrant, one step at a time.
+
+  class ThreadPool
+  {
+  public:
+    ThreadPool(int threads);
+    /// Waits for the threads to end
+    ~ThreadPool();
+
+    int threads() const;
+
+    /// Calls task(i) for every i in [0, tasks), returns when all are done
+    void run(int tasks, std::function<void(int)> const & task);
+
+  private:
+    void work();
+    bool runNext(std::unique_lock<std::mutex> & lock);
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;  // New tasks or stop
+    std::condition_variable done_;  // Last task finished
+    std::function<void(int)> const * task_;
+    int tasks_;    // Tasks of this run
+    int next_;     // Next task to start
+    int pending_;  // Tasks not finished
+    bool stop_;
+  }; //class ThreadPool
+
+}
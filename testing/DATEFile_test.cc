@@ -0,0 +1,422 @@
+#include "catch.hpp"
+#include "RawDataInput.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Small DATE files written on the fly, one event per call: a bare
+// header followed by size-80 bytes of payload filled with nbInRun
+static std::string tempPath(std::string const & suffix = ""){
+	char name[] = "/tmp/datefile_test_XXXXXX";
+	int fd = mkstemp(name);
+	::close(fd);
+	unlink(name);
+	return std::string(name) + suffix;
+}
+
+static void writeEvent(std::FILE * file, unsigned int nbInRun, unsigned int size,
+		unsigned int type = PHYSICS_EVENT){
+	eventHeaderStruct header;
+	memset(&header, 0, sizeof(header));
+	header.eventSize     = size;
+	header.eventMagic    = EVENT_MAGIC_NUMBER;
+	header.eventHeadSize = sizeof(eventHeaderStruct);
+	header.eventType     = type;
+	header.eventId[0]    = nbInRun;
+	std::fwrite(&header, sizeof(header), 1, file);
+	std::vector<unsigned char> payload(size - sizeof(header), nbInRun & 0xff);
+	std::fwrite(payload.data(), 1, payload.size(), file);
+}
+
+// Every ReadConfig registers the same logger
+static ReadConfig * makeConfig(std::string const & json){
+	std::string filename = tempPath(".json");
+	std::ofstream(filename.c_str()) << json;
+	spdlog::drop("config");
+	ReadConfig * config = new ReadConfig(filename);
+	unlink(filename.c_str());
+	return config;
+}
+
+TEST_CASE("Event at the end of a mapped file", "[mmap_eof]") {
+	//One event ending exactly at the end of the last page of the file
+	size_t page = sysconf(_SC_PAGESIZE);
+	std::string filename = tempPath(".rd");
+	std::FILE * file = std::fopen(filename.c_str(), "wb");
+	writeEvent(file, 7, page);
+	std::fclose(file);
+
+	ReadConfig * config = makeConfig("{\"input_mode\": \"mmap\", \"index_files\": false, \"read_ahead\": 0}");
+	//The file is mapped in the one page hole left below an inaccessible
+	//page, reading past it faults unless the mapping has a guard page
+	void * fence = mmap(NULL, 2*page, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	munmap(fence, page);
+
+	next::DATEFile date(filename, config);
+	REQUIRE(date.open());
+	REQUIRE(date.mode() == next::InputMode::mmap);
+	REQUIRE(date.buildIndex() == 1);
+
+	unsigned char * buffer;
+	REQUIRE(date.loadNextEvent(&buffer) == 7);
+
+	//Three words at the end of the event, the last pair is read whole
+	int16_t flip[4];
+	flipWords(6, (int16_t*) (buffer + page - 6), flip);
+	REQUIRE(flip[0] == 0x0707);
+	REQUIRE(flip[1] == 0x0707);
+	REQUIRE(flip[3] == 0x0707);
+
+	date.releaseEvent(buffer);
+	date.close();
+	munmap((unsigned char*) fence + page, page);
+	delete config;
+	unlink(filename.c_str());
+}
+
+TEST_CASE("Event cut short after indexing", "[short_read]") {
+	//Read directly, through the read-ahead thread and by blocks
+	for (std::string json : {"{\"input_mode\": \"stdio\", \"read_ahead\": 0}",
+			"{\"input_mode\": \"stdio\", \"read_ahead\": 2}",
+			"{\"input_mode\": \"block\", \"read_ahead\": 0}"}){
+		std::string filename = tempPath(".rd");
+		std::FILE * file = std::fopen(filename.c_str(), "wb");
+		writeEvent(file, 1, 200);
+		writeEvent(file, 2, 200);
+		std::fclose(file);
+
+		ReadConfig * config = makeConfig(json);
+		next::DATEFile date(filename, config);
+		REQUIRE(date.open());
+		REQUIRE(date.buildIndex() == 2);
+
+		//The file loses the end of the second event once indexed
+		REQUIRE(truncate(filename.c_str(), 300) == 0);
+		unsigned char * buffer;
+		REQUIRE(date.loadNextEvent(&buffer) == 1);
+		date.releaseEvent(buffer);
+		REQUIRE(date.loadNextEvent(&buffer) == -1);
+
+		date.close();
+		delete config;
+		unlink(filename.c_str());
+	}
+}
+
+TEST_CASE("Find the files of a run", "[run_files]") {
+	std::string dir = tempPath();
+	REQUIRE(mkdir(dir.c_str(), 0700) == 0);
+	const char * names[] = {"run_5.gdc1next.001.rd", "run_5.gdc1next.000.rd.gz",
+		"run_5.gdc1next.010.rd.zst", "run_5.gdc2next.000.rd",
+		"run_5.gdc1next.000.rd.gz.idx", "run_5.gdc2next.000.rd.tmp", "notes.txt",
+		"run_5.gdc2next.000.rd.zst", "run_6.gdc1next.000.rd", "run_6.gdc3next.000.rd"};
+	for (auto name : names){
+		std::ofstream((dir + "/" + name).c_str());
+	}
+
+	//Grouped by GDC and sorted by chunk number, sidecars, other runs and
+	//compressed copies of plain chunks left out
+	std::vector<std::vector<std::string> > expected = {
+		{dir + "/run_5.gdc1next.000.rd.gz", dir + "/run_5.gdc1next.001.rd",
+		 dir + "/run_5.gdc1next.010.rd.zst"},
+		{dir + "/run_5.gdc2next.000.rd"}};
+
+	SECTION("Run directory") {
+		REQUIRE(next::findRunFiles(dir, false) == expected);
+	}
+
+	SECTION("Glob pattern") {
+		REQUIRE(next::findRunFiles(dir + "/run_5.gdc*", false) == expected);
+	}
+
+	for (auto name : names){
+		unlink((dir + "/" + name).c_str());
+	}
+	rmdir(dir.c_str());
+}
+
+// Chunk with events first to first+count-1
+static std::string writeChunk(std::string const & filename, unsigned int first, unsigned int count){
+	std::FILE * file = std::fopen(filename.c_str(), "wb");
+	for (unsigned int nb=first; nb<first+count; nb++){
+		writeEvent(file, nb, 200);
+	}
+	std::fclose(file);
+	return filename;
+}
+
+TEST_CASE("Seek events in a chain of chunks", "[stream_seek]") {
+	std::string base = tempPath();
+	std::vector<std::string> chunks = {
+		writeChunk(base + ".000.rd", 1, 3),
+		writeChunk(base + ".001.rd", 4, 3),
+		writeChunk(base + ".002.rd", 7, 3)};
+
+	unsigned char * buffer;
+
+	SECTION("Indexed chunks, backwards too") {
+		ReadConfig * config = makeConfig("{\"input_mode\": \"stdio\", \"index_files\": false}");
+		next::DATEStream stream(chunks, config);
+		REQUIRE(stream.open());
+		REQUIRE(stream.buildIndex() == 9);
+
+		REQUIRE(stream.seekEvent(8));
+		REQUIRE(stream.loadNextEvent(&buffer) == 8);
+		stream.releaseEvent(buffer);
+
+		REQUIRE(stream.seekEvent(2));
+		for (int nb=2; nb<=9; nb++){
+			REQUIRE(stream.loadNextEvent(&buffer) == nb);
+			stream.releaseEvent(buffer);
+		}
+		REQUIRE(stream.loadNextEvent(&buffer) == -1);
+		REQUIRE_FALSE(stream.seekEvent(10));
+		delete config;
+	}
+
+	SECTION("Stream mode, only forward") {
+		ReadConfig * config = makeConfig("{\"input_mode\": \"stream\"}");
+		next::DATEStream stream(chunks, config);
+		REQUIRE(stream.open());
+		stream.buildIndex();
+
+		REQUIRE(stream.seekEvent(5));
+		REQUIRE(stream.loadNextEvent(&buffer) == 5);
+		stream.releaseEvent(buffer);
+
+		//Events before the current one are gone
+		REQUIRE_FALSE(stream.seekEvent(2));
+		REQUIRE(stream.seekEvent(8));
+		REQUIRE(stream.loadNextEvent(&buffer) == 8);
+		stream.releaseEvent(buffer);
+		REQUIRE(stream.loadNextEvent(&buffer) == 9);
+		stream.releaseEvent(buffer);
+		REQUIRE(stream.loadNextEvent(&buffer) == -1);
+		delete config;
+	}
+
+	for (auto const & chunk : chunks){
+		unlink(chunk.c_str());
+	}
+}
+
+static bool sameIndex(std::vector<next::EventIndexEntry> const & a, std::vector<next::EventIndexEntry> const & b){
+	if (a.size() != b.size()){
+		return false;
+	}
+	for (size_t i=0; i<a.size(); i++){
+		if (a[i].offset != b[i].offset || a[i].size != b[i].size ||
+				a[i].type != b[i].type || a[i].nbInRun != b[i].nbInRun){
+			return false;
+		}
+	}
+	return true;
+}
+
+TEST_CASE("Index file round trip", "[index_file]") {
+	std::string filename = tempPath(".rd");
+	std::FILE * file = std::fopen(filename.c_str(), "wb");
+	writeEvent(file, 0, 120, START_OF_RUN);
+	for (unsigned int nb=1; nb<=4; nb++){
+		writeEvent(file, nb, 100 + 40*nb);
+	}
+	std::fclose(file);
+	ReadConfig * config = makeConfig("{\"input_mode\": \"stdio\", \"index_files\": true}");
+
+	//The first scan writes the index file
+	next::DATEFile scanned(filename, config);
+	REQUIRE(scanned.open());
+	REQUIRE(scanned.buildIndex() == 4);
+	REQUIRE(scanned.index().size() == 5);
+	REQUIRE(access((filename + ".idx").c_str(), R_OK) == 0);
+
+	next::DATEFile indexed(filename, config);
+	REQUIRE(indexed.open());
+	REQUIRE(indexed.buildIndex() == 4);
+	REQUIRE(indexed.firstEvent() == 1);
+	REQUIRE(sameIndex(scanned.index(), indexed.index()));
+
+	//The last event number changed behind its back, same size and time:
+	//the copy of its header in the index file tells
+	struct stat st;
+	stat(filename.c_str(), &st);
+	file = std::fopen(filename.c_str(), "r+b");
+	unsigned int nb = 50;
+	std::fseek(file, 660 + offsetof(eventHeaderStruct, eventId), SEEK_SET);
+	std::fwrite(&nb, sizeof(nb), 1, file);
+	std::fclose(file);
+	struct timeval times[2] = {{st.st_mtime, 0}, {st.st_mtime, 0}};
+	utimes(filename.c_str(), times);
+
+	next::DATEFile modified(filename, config);
+	REQUIRE(modified.open());
+	REQUIRE(modified.buildIndex() == 4);
+	REQUIRE(modified.index().back().nbInRun == 50);
+
+	//An index entry past the end of the file is not trusted either
+	std::FILE * idx = std::fopen((filename + ".idx").c_str(), "r+b");
+	std::fseek(idx, -(long) sizeof(next::EventIndexEntry), SEEK_END);
+	uint64_t offset = st.st_size;
+	std::fwrite(&offset, sizeof(offset), 1, idx);
+	std::fclose(idx);
+
+	next::DATEFile outside(filename, config);
+	REQUIRE(outside.open());
+	REQUIRE(outside.buildIndex() == 4);
+	REQUIRE(outside.index().back().offset == 660);
+
+	//A new event changes the size, the file is scanned again
+	file = std::fopen(filename.c_str(), "ab");
+	writeEvent(file, 51, 100);
+	std::fclose(file);
+
+	next::DATEFile rescanned(filename, config);
+	REQUIRE(rescanned.open());
+	REQUIRE(rescanned.buildIndex() == 5);
+	REQUIRE(rescanned.index().back().nbInRun == 51);
+
+	scanned.close();
+	indexed.close();
+	modified.close();
+	outside.close();
+	rescanned.close();
+	delete config;
+	unlink((filename + ".idx").c_str());
+	unlink(filename.c_str());
+}
+
+TEST_CASE("Read a chain of chunks", "[stream_chunks]") {
+	std::string dir = tempPath();
+	REQUIRE(mkdir(dir.c_str(), 0700) == 0);
+	//Written out of order, the middle chunk without selected events
+	writeChunk(dir + "/run_8.gdc1next.002.rd", 4, 2);
+	writeChunk(dir + "/run_8.gdc1next.000.rd", 1, 3);
+	std::FILE * file = std::fopen((dir + "/run_8.gdc1next.001.rd").c_str(), "wb");
+	writeEvent(file, 0, 100, END_OF_RUN);
+	std::fclose(file);
+
+	std::vector<std::vector<std::string> > files = next::findRunFiles(dir, false);
+	REQUIRE(files.size() == 1);
+	REQUIRE(files[0].size() == 3);
+
+	ReadConfig * config = makeConfig("{\"input_mode\": \"mmap\", \"index_files\": false}");
+	next::DATEStream stream(files[0], config);
+	REQUIRE(stream.open());
+	REQUIRE(stream.buildIndex() == 5);
+	REQUIRE(stream.firstEvent() == 1);
+
+	unsigned char * buffer;
+	for (int nb=1; nb<=5; nb++){
+		REQUIRE(stream.loadNextEvent(&buffer) == nb);
+		stream.releaseEvent(buffer);
+	}
+	REQUIRE(stream.loadNextEvent(&buffer) == -1);
+
+	delete config;
+	for (auto const & chunk : files[0]){
+		unlink(chunk.c_str());
+	}
+	rmdir(dir.c_str());
+}
+
+TEST_CASE("Merge the events of several GDCs", "[merger]") {
+	std::string base = tempPath();
+	std::vector<std::string> gdc1 = {writeChunk(base + ".gdc1.000.rd", 1, 1),
+		writeChunk(base + ".gdc1.001.rd", 3, 1), writeChunk(base + ".gdc1.002.rd", 5, 3)};
+	std::string gdc2 = base + ".gdc2.000.rd";
+	std::FILE * file = std::fopen(gdc2.c_str(), "wb");
+	for (unsigned int nb : {2, 3, 4, 8, 10}){
+		writeEvent(file, nb, 160);
+	}
+	std::fclose(file);
+
+	ReadConfig * config = makeConfig("{\"input_mode\": \"stdio\", \"index_files\": false, \"read_ahead\": 2}");
+	next::DATEMerger merger(config);
+	merger.addStream(new next::DATEStream(gdc1, config, merger.bufferPool()));
+	merger.addStream(new next::DATEStream(std::vector<std::string>(1, gdc2), config, merger.bufferPool()));
+	REQUIRE(merger.buildIndex() == 10);
+	REQUIRE(merger.firstEvent() == 1);
+
+	//Ordered by event number, the second copy of event 3 is dropped
+	unsigned char * buffer;
+	std::vector<int> events;
+	int nb;
+	while ((nb = merger.loadNextEvent(&buffer)) >= 0){
+		REQUIRE(EVENT_ID_GET_NB_IN_RUN(((eventHeaderStruct*) buffer)->eventId) == (unsigned int) nb);
+		events.push_back(nb);
+		merger.releaseEvent(buffer);
+	}
+	REQUIRE(events == std::vector<int>({1, 2, 3, 4, 5, 6, 7, 8, 10}));
+
+	//Back to one event, then all the GDCs merged again from there
+	REQUIRE(merger.seekEvent(4));
+	events.clear();
+	while ((nb = merger.loadNextEvent(&buffer)) >= 0){
+		events.push_back(nb);
+		merger.releaseEvent(buffer);
+	}
+	REQUIRE(events == std::vector<int>({4, 5, 6, 7, 8, 10}));
+
+	//The copy of event 3 in the other GDC is still dropped after a seek
+	REQUIRE(merger.seekEvent(2));
+	events.clear();
+	for (int i=0; i<3; i++){
+		events.push_back(merger.loadNextEvent(&buffer));
+		merger.releaseEvent(buffer);
+	}
+	REQUIRE(events == std::vector<int>({2, 3, 4}));
+	REQUIRE_FALSE(merger.seekEvent(9));
+
+	delete config;
+	for (auto const & chunk : gdc1){
+		unlink(chunk.c_str());
+	}
+	unlink(gdc2.c_str());
+}
+
+TEST_CASE("Read a gzip compressed file", "[gzip_input]") {
+	//Events bigger than the decompression chunks too
+	std::vector<unsigned int> sizes = {100, 300000, 84, 5000};
+	std::string plain = tempPath(".rd");
+	std::FILE * file = std::fopen(plain.c_str(), "wb");
+	for (unsigned int i=0; i<sizes.size(); i++){
+		writeEvent(file, i+1, sizes[i]);
+	}
+	std::fclose(file);
+
+	std::string filename = plain + ".gz";
+	std::ifstream in(plain.c_str(), std::ios::binary);
+	std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+	gzFile gz = gzopen(filename.c_str(), "wb");
+	gzwrite(gz, data.data(), data.size());
+	gzclose(gz);
+
+	ReadConfig * config = makeConfig("{\"input_mode\": \"mmap\"}");
+	next::DATEFile date(filename, config);
+	REQUIRE(date.open());
+	REQUIRE(date.mode() == next::InputMode::stream);
+	date.buildIndex();
+
+	unsigned char * buffer;
+	for (unsigned int i=0; i<sizes.size(); i++){
+		REQUIRE(date.loadNextEvent(&buffer) == (int) i+1);
+		eventHeaderStruct * header = (eventHeaderStruct*) buffer;
+		REQUIRE(header->eventSize == sizes[i]);
+		REQUIRE(buffer[sizes[i] - 1] == i+1);
+		date.releaseEvent(buffer);
+	}
+	REQUIRE(date.loadNextEvent(&buffer) == -1);
+	REQUIRE(date.selectedEvents() == 4);
+
+	date.close();
+	delete config;
+	unlink(filename.c_str());
+	unlink(plain.c_str());
+}
@@ -48,6 +48,95 @@ TEST_CASE("Test seq counter removal", "[seqcounter_removal]") {
 	}
 }
 
+TEST_CASE("Vector flip words", "[flip_words_vector]") {
+	//Several frames, sizes around the skips and odd sizes
+	const unsigned int words = 3996 * 5 + 64;
+	std::vector<int16_t> data(words);
+	for(unsigned int i=0; i < words; i++){
+		data[i] = (int16_t) (i * 2654435761u >> 7);
+	}
+
+	std::vector<unsigned int> sizes = {0, 1, 2, 3, 4, 5, 6, 7, 8, 30, 31, 33, 64, 1000};
+	for(unsigned int frame=1; frame <= 4; frame++){
+		for(int delta=-9; delta <= 9; delta++){
+			sizes.push_back(3996 * 2 * frame + delta);
+		}
+	}
+
+	for(auto size : sizes){
+		std::vector<int16_t> expected(words, 0x5a5a);
+		std::vector<int16_t> result(words, 0x5a5a);
+		flipWordsScalar(size, data.data(), expected.data());
+		flipWords(size, data.data(), result.data());
+		INFO("size " << size);
+		REQUIRE(result == expected);
+	}
+}
+
+TEST_CASE("Unpack 12-bit samples", "[unpack_samples]") {
+	const int channels = 72;
+	std::vector<int16_t> data(channels/4*3 + 1);
+	for(unsigned int i=0; i < data.size(); i++){
+		data[i] = (int16_t) (i * 2654435761u >> 9);
+	}
+
+	for(int count=0; count <= channels; count++){
+		std::vector<uint16_t> expected(channels, 0x5a5a);
+		std::vector<uint16_t> scalar(channels, 0x5a5a);
+		std::vector<uint16_t> result(channels, 0x5a5a);
+
+		//Previous decodeCharge extraction, two words and a shift
+		int16_t * ptr = data.data();
+		for(int chan=0; chan < count; chan++){
+			int Charge = 0;
+			int16_t * charge_ptr = (int16_t *) &Charge;
+			memcpy(charge_ptr+1, ptr, 2);
+			memcpy(charge_ptr, ptr+1, 2);
+			int shift[4] = {20, 8, 12, 0};
+			expected[chan] = (Charge >> shift[chan % 4]) & 0x0fff;
+			if((chan % 4) == 1){
+				ptr += 1;
+			}
+			if((chan % 4) == 3){
+				ptr += 2;
+			}
+		}
+
+		unpackSamples12Scalar(data.data(), count, scalar.data());
+		unpackSamples12(data.data(), count, result.data());
+		INFO("count " << count);
+		REQUIRE(scalar == expected);
+		REQUIRE(result == expected);
+	}
+}
+
+TEST_CASE("Reconstruct deltas", "[reconstruct_deltas]") {
+	const int size = 37;
+	std::vector<int> deltas(size), keep(size);
+	for(int i=0; i < size; i++){
+		deltas[i] = (int) (i * 2654435761u >> 20) - 2048;
+		keep[i] = (i % 7 == 3 || i % 11 == 0) ? 0 : -1;
+	}
+
+	for(int count=0; count <= size; count++){
+		std::vector<int> expected(size, 0x5a5a);
+		std::vector<int> scalar(size, 0x5a5a);
+		std::vector<int> result(size, 0x5a5a);
+
+		int previous = 1000;
+		for(int i=0; i < count; i++){
+			expected[i] = keep[i] ? previous + deltas[i] : deltas[i];
+			previous = expected[i];
+		}
+
+		reconstructDeltasScalar(deltas.data(), keep.data(), count, 1000, scalar.data());
+		reconstructDeltas(deltas.data(), keep.data(), count, 1000, result.data());
+		INFO("count " << count);
+		REQUIRE(scalar == expected);
+		REQUIRE(result == expected);
+	}
+}
+
 TEST_CASE("Test PMT elecID", "[pmt_elecid]") {
 	// Hotel version
 	//We are using FEC 2-3 for channels 0-15
@@ -72,6 +161,24 @@ TEST_CASE("Test PMT elecID", "[pmt_elecid]") {
 	}
 }
 
+TEST_CASE("Test PMT position", "[pmt_position]") {
+	// Up to India the electronic ID is the position
+	for(int ch=0; ch<12; ch++){
+		REQUIRE(computePmtPosition( 2, ch, 9) == 2*ch);
+		REQUIRE(computePmtPosition(11, ch, 9) == 24 + 2*ch+1);
+	}
+
+	// Juliett: FECs 2-3 first, FECs 26-27 last
+	int fecs[14] = {2,3,6,7,10,11,14,15,18,19,22,23,26,27};
+	for(int fec=0; fec<14; fec++){
+		for(int ch=0; ch<12; ch++){
+			int pos = computePmtPosition(fecs[fec], ch, 10);
+			REQUIRE(pos == (fec/2)*24 + 2*ch + fec%2);
+			REQUIRE(PositiontoPmtID(pos) == computePmtElecID(fecs[fec], ch, 10));
+		}
+	}
+}
+
 TEST_CASE("Test SiPM Channel Mask", "[sipm_chmask]") {
 	const unsigned int nwords = 4;
 	const unsigned int sensors_per_word = 16;
@@ -171,6 +278,30 @@ TEST_CASE("Build SiPM data", "[sipm_data]") {
 	}
 }
 
+TEST_CASE("SiPM link cursor", "[sipm_cursor]") {
+	const unsigned int size = 12;
+	unsigned short data1[size] = {0x0000, 0x1111, 0x2222, 0x3333,
+		0x4444,	0x5555, 0x6666, 0x7777, 0x8888, 0x9999, 0xaaaa, 0xbbbb};
+	unsigned short data2[size] = {0x0123, 0x4567, 0x89ab, 0xcdef,
+		0xfedc,	0xba98, 0x7654, 0x3210, 0x1234, 0x5678, 0x9abc, 0xdef0};
+
+	int16_t test_data[2*size];
+	buildSipmData(size, test_data, (int16_t*) data1, (int16_t*) data2);
+
+	next::SipmLinkCursor cursor((int16_t*) data1, (int16_t*) data2, size);
+	for(unsigned int i=0; i < 2*size; i++){
+		REQUIRE(*cursor == test_data[i]);
+		REQUIRE((cursor+1)[0] == (i+1 < 2*size ? test_data[i+1] : -1));
+		cursor++;
+	}
+	REQUIRE(cursor.position() == 2*size);
+
+	//The end of the links reads as the end of data mark
+	REQUIRE(*cursor == (int16_t) 0xFFFF);
+	cursor += 5;
+	REQUIRE(cursor[1] == (int16_t) 0xFFFF);
+}
+
 TEST_CASE("Selected event", "[selected_event]") {
 	eventHeaderStruct event;
 
@@ -182,6 +313,26 @@ TEST_CASE("Selected event", "[selected_event]") {
 	}
 }
 
+TEST_CASE("Find event magic", "[event_magic]") {
+	const unsigned int size = 64;
+	unsigned char data[size];
+	memset(data, 0xfe, size);
+	eventMagicType magic = EVENT_MAGIC_NUMBER;
+
+	REQUIRE(findEventMagic(data, size) == size);
+
+	//First byte of the magic repeated before it
+	memcpy(data + 21, &magic, sizeof(magic));
+	REQUIRE(findEventMagic(data, size) == 21);
+	REQUIRE(findEventMagic(data + 22, size - 22) == size - 22);
+
+	//Magic at the very end, and cut by the end of the data
+	memcpy(data + size - 4, &magic, sizeof(magic));
+	REQUIRE(findEventMagic(data + 22, size - 22) == size - 4 - 22);
+	REQUIRE(findEventMagic(data + 22, size - 23) == size - 23);
+	REQUIRE(findEventMagic(data, 3) == 3);
+}
+
 //TODO test pointer position
 TEST_CASE("Decode charge", "[decode_charge]") {
 	//Max sensors: 64
@@ -627,9 +778,10 @@ TEST_CASE("Test create PMTs", "[create_pmts]") {
 	int bufferSamples = 52000;
 	int pmtPositions[npmts];
 	int fec = 2;
+	int version = 8;
 	std::vector<int> elecIDs = {0,1,2,3,4,5,6,7};
 
-	CreatePMTs(&pmts, pmtPositions, &elecIDs, bufferSamples, false);
+	CreatePMTs(&pmts, pmtPositions, &elecIDs, bufferSamples, false, version);
 
 	for(unsigned int ch=0; ch<npmts; ch++){
 		REQUIRE(pmts[ch].digType() == next::digitType::RAW);
@@ -680,10 +832,11 @@ TEST_CASE("Decode compressed pmts", "[decode_compressed]") {
 
 	int16_t * ptr = (int16_t*) data;
 	int current_bit = 31;
+	HuffmanTable table(&huffman);
 
 	for(int time=0; time<bufferSamples; time++){
 		// printf("time: %d\n\n", time);
-		rdata.decodeChargeIndiaPmtCompressed(ptr, &current_bit, digits, &huffman, channelMaskVec, positions, time);
+		rdata.decodeChargeIndiaPmtCompressed(ptr, &current_bit, digits, table, channelMaskVec, positions, time);
 	}
 
 	for(unsigned s=0; s<nsensors; s++){
@@ -704,3 +857,263 @@ TEST_CASE("Decode compressed pmts", "[decode_compressed]") {
 	digits.clear();
 	channelMaskVec.clear();
 }
+
+TEST_CASE("Huffman table", "[huffman_table]") {
+	// Canonical code with one code of each length from 1 to 16 and two of
+	// 17 bits, deeper than the first table and one subtable
+	Huffman huffman;
+	huffman.next[0] = NULL;
+	huffman.next[1] = NULL;
+
+	// Same codes added from their strings, as from the DB
+	HuffmanTable codes;
+	codes.add(7, "0");
+	codes.build();
+	codes.clear();
+
+	int control_code = 123456;
+	unsigned int code = 0;
+	for(int length=1; length <= 17; length++){
+		int count = (length == 17) ? 2 : 1;
+		for(int i=0; i<count; i++){
+			char bits[32];
+			for(int b=0; b<length; b++){
+				bits[b] = '0' + ((code >> (length - 1 - b)) & 1);
+			}
+			bits[length] = 0;
+			int value = (length == 3) ? control_code : length * 10 + i;
+			parse_huffman_line(value, bits, &huffman);
+			codes.add(value, bits);
+			code++;
+		}
+		code <<= 1;
+	}
+
+	HuffmanTable table(&huffman);
+	REQUIRE(!table.empty());
+	REQUIRE(codes.empty());
+	codes.build();
+
+	unsigned int seed = 12345;
+	for(int n=0; n < 20000; n++){
+		seed = seed * 1103515245 + 12345;
+		int data = (int) (seed ^ (seed << 13));
+		int position = 16 + n % 16;
+
+		int tree_bit  = position;
+		int table_bit = position;
+		int codes_bit = position;
+		int tree_value  = decode_compressed_value(100, data, control_code, &tree_bit, &huffman);
+		int table_value = decode_compressed_value(100, data, control_code, &table_bit, table);
+		int codes_value = decode_compressed_value(100, data, control_code, &codes_bit, codes);
+		INFO("data 0x" << std::hex << data << std::dec << " position " << position);
+		REQUIRE(table_value == tree_value);
+		REQUIRE(table_bit == tree_bit);
+		REQUIRE(codes_value == tree_value);
+		REQUIRE(codes_bit == tree_bit);
+	}
+
+	free_huffman(&huffman);
+	REQUIRE(huffman.next[0] == NULL);
+	REQUIRE(huffman.next[1] == NULL);
+}
+
+TEST_CASE("Bit reader", "[bit_reader]") {
+	const int nwords = 64;
+	std::vector<int16_t> words(nwords + 4);
+	for(unsigned int i=0; i < words.size(); i++){
+		words[i] = (int16_t) (i * 2654435761u >> 11);
+	}
+	// Bit i of the stream, most significant first in each word
+	auto bit = [&](size_t i){ return ((uint16_t) words[i/16] >> (15 - i%16)) & 1; };
+
+	SECTION("Reads, peeks and alignment") {
+		next::BitReader<int16_t*> reader(words.data(), 3);
+		size_t position = 3;
+		unsigned int seed = 7;
+		while(position + 48 < 16 * nwords){
+			seed = seed * 1103515245 + 12345;
+			int n = 1 + (seed >> 16) % 32;
+
+			uint32_t expected = 0;
+			for(int i=0; i<32; i++){
+				expected = (expected << 1) | bit(position + i);
+			}
+			REQUIRE(reader.peek32() == expected);
+
+			if((seed >> 8) % 8 == 0){
+				reader.align();
+				position = (position + 15) / 16 * 16;
+				REQUIRE(reader.bitInWord() == 0);
+				REQUIRE(reader.word() == words.data() + position / 16);
+			}else{
+				REQUIRE(reader.read(n) == expected >> (32 - n));
+				position += n;
+			}
+			REQUIRE(reader.consumed() == position);
+			REQUIRE(reader.word() == words.data() + position / 16);
+			REQUIRE(reader.bitInWord() == (int) (position % 16));
+		}
+	}
+
+	SECTION("Interleaved links") {
+		std::vector<int16_t> linkA, linkB;
+		for(int i=0; i < nwords; i+=2){
+			linkA.push_back(words[i]);
+			linkB.push_back(words[i+1]);
+		}
+		next::SipmLinkCursor cursor(linkA.data(), linkB.data(), nwords/2);
+		next::BitReader<next::SipmLinkCursor> reader(cursor);
+		for(size_t position=0; position + 13 <= 16 * nwords; position += 13){
+			uint32_t expected = 0;
+			for(int i=0; i<13; i++){
+				expected = (expected << 1) | bit(position + i);
+			}
+			REQUIRE(reader.read(13) == expected);
+		}
+		//Past the end of the links the cursor gives 0xFFFF
+		reader.align();
+		REQUIRE(reader.read(16) == 0xFFFF);
+	}
+}
+
+TEST_CASE("Parallel Huffman decoding", "[parallel_decode]") {
+	int control_code = 123456;
+	const char * codes[] = {"00", "010", "011", "100", "101", "1100", "1101", "1110", "11110", "11111"};
+	int values[] = {0, 1, -1, 2, -2, 3, -3, 4, -4, control_code};
+	HuffmanTable huffman;
+	for(int i=0; i<10; i++){
+		huffman.add(values[i], codes[i]);
+	}
+	huffman.build();
+
+	// Stream of channels x samples symbols, time after time
+	const int channels = 8;
+	const int samples = 500;
+	std::vector<int> expected_deltas(channels * samples);
+	std::vector<int> expected_keep(channels * samples);
+	std::vector<int16_t> words;
+	size_t bits = 0;
+	auto push = [&](unsigned int value, int length){
+		for(int b=length-1; b>=0; b--){
+			if(bits % 16 == 0){
+				words.push_back(0);
+			}
+			words.back() |= ((value >> b) & 1) << (15 - bits % 16);
+			bits++;
+		}
+	};
+	unsigned int seed = 4321;
+	for(int time=0; time<samples; time++){
+		for(int chan=0; chan<channels; chan++){
+			seed = seed * 1103515245 + 12345;
+			int symbol = (seed >> 16) % 10;
+			for(const char * c=codes[symbol]; *c; c++){
+				push(*c - '0', 1);
+			}
+			int index = chan * samples + time;
+			if(values[symbol] == control_code){
+				expected_deltas[index] = (seed >> 4) & 0xfff;
+				expected_keep[index] = 0;
+				push(expected_deltas[index], 12);
+			}else{
+				expected_deltas[index] = values[symbol];
+				expected_keep[index] = -1;
+			}
+		}
+	}
+	// Rest of the payload
+	for(int i=0; i<40; i++){
+		words.push_back(-1);
+	}
+	size_t payload = (words.size() - 4) * 16;
+
+	std::vector<int> deltas(channels * samples), keep(channels * samples);
+	next::BitReader<int16_t*> reader(words.data());
+	decodeCompressedSymbols(reader, huffman, channels, samples, deltas.data(), keep.data());
+	REQUIRE(deltas == expected_deltas);
+	REQUIRE(keep == expected_keep);
+
+	next::ThreadPool pool(4);
+	REQUIRE(pool.threads() == 4);
+	for(int segments : {1, 2, 3, 7, 16, 100}){
+		std::vector<int> parallel_deltas(channels * samples, 0x5a5a);
+		std::vector<int> parallel_keep(channels * samples, 0x5a5a);
+		decodeCompressedSymbolsParallel(pool, words.data(), payload, huffman, channels, samples,
+				segments, parallel_deltas.data(), parallel_keep.data());
+		INFO("segments " << segments);
+		REQUIRE(parallel_deltas == expected_deltas);
+		REQUIRE(parallel_keep == expected_keep);
+	}
+}
+
+TEST_CASE("RAW PMT records", "[pmt_raw]") {
+	next::RawDataInput rdata = next::RawDataInput();
+	spdlog::drop("eventreader");
+	next::EventReader* reader = new next::EventReader(0);
+	const int bufferSamples = 3 * RAW_BLOCK_SAMPLES + 500;
+	reader->SetTriggerFT(700);
+	reader->SetBufferSamples(bufferSamples);
+	reader->SetFTBit(0);
+	reader->SetPreTriggerSamples(2000);
+
+	// One record per sample: FT word and the charges of 8 channels
+	const int channels = 8;
+	const int stride = 1 + channels - channels/4;
+	std::vector<int16_t> data(bufferSamples * stride);
+	int nextFT = -1, nextFThm = -1;
+	unsigned int seed = 97;
+	for(int time=0; time<bufferSamples; time++){
+		rdata.computeNextFThm(&nextFT, &nextFThm, reader);
+		data[time * stride] = nextFThm;
+		for(int w=1; w<stride; w++){
+			seed = seed * 1103515245 + 12345;
+			data[time * stride + w] = seed >> 16;
+		}
+	}
+
+	auto decode = [&](next::ThreadPool * pool, int count){
+		std::vector<std::vector<unsigned short> > waveforms(channels, std::vector<unsigned short>(bufferSamples, 0));
+		std::vector<unsigned short *> ptrs;
+		for(auto & wf : waveforms){
+			ptrs.push_back(wf.data());
+		}
+		decodePmtRawSamples(pool, data.data(), channels, count, ptrs.data());
+		return waveforms;
+	};
+	auto check = [&](int count){
+		std::vector<std::vector<unsigned short> > serial = decode(NULL, count);
+		next::ThreadPool pool(4);
+		REQUIRE(decode(&pool, count) == serial);
+
+		uint16_t charges[channels];
+		for(int time=0; time<count; time++){
+			unpackSamples12Scalar(data.data() + time * stride + 1, channels, charges);
+			for(int chan=0; chan<channels; chan++){
+				REQUIRE(serial[chan][time] == charges[chan]);
+			}
+		}
+		// Nothing written after the last record
+		for(int chan=0; chan<channels; chan++){
+			REQUIRE(serial[chan][count] == 0);
+		}
+	};
+
+	SECTION("Buffer ending in the middle of a block") {
+		int records = 2 * RAW_BLOCK_SAMPLES + 1000;
+		// Half a record after the last whole one
+		int16_t * end = data.data() + records * stride + stride/2;
+		int count = rdata.countPmtRawRecords(data.data(), end, channels, bufferSamples, reader);
+		REQUIRE(count == records);
+		check(count);
+	}
+
+	SECTION("FT out of sequence") {
+		int bad = 3 * RAW_BLOCK_SAMPLES - 7;
+		data[bad * stride] ^= 1;
+		int16_t * end = data.data() + data.size();
+		int count = rdata.countPmtRawRecords(data.data(), end, channels, bufferSamples, reader);
+		REQUIRE(count == bad);
+		check(count);
+	}
+}
@@ -12,87 +12,50 @@ namespace spd = spdlog;
 
 next::CopyEvents::CopyEvents(ReadConfig * config) :
 	run_(0),
-	cfptr_(),
+	input_(),
 	entriesThisFile_(-1),
 	event_(),
 	eventNo_(0),
 	skip_(config->skip()),
 	max_events_(config->max_events()),
 	buffer_(NULL),
+	events_(config->events()),
 	verbosity_(config->verbosity()),
-	twoFiles_(config->two_files())
+	twoFiles_(config->two_files()),
+	config_(config)
 {
+	_log = spd::stdout_color_mt("copyevents");
 }
 
 
-void next::CopyEvents::countEvents(std::FILE* file, int * nevents, int * firstEvt){
-	*nevents = 0;
-	*firstEvt = 0;
-	unsigned char * buffer;
-
-	*firstEvt = loadNextEvent(file, &buffer);
-	free(buffer);
-	int evt_number= *firstEvt;
-
-	while(evt_number > 0){
-		(*nevents)++;
-		evt_number = loadNextEvent(file, &buffer);
-//		free(buffer);
-	}
-}
-
-//Loads one event from the file
-int next::CopyEvents::loadNextEvent(std::FILE* file, unsigned char ** buffer){
-	int evt_number = -1;
-
-	eventHeaderStruct header;
-	unsigned int headerSize = sizeof(eventHeaderStruct);
-	unsigned int readSize = this->readHeaderSize(file);
-	if ((readSize != headerSize) && readSize) { //if we read 0 is the end of the file
-		//TODO throw art::Exception(art::errors::FileReadError;)
-		//_log->error("Event header size of {} bytes read from data does not match expected size of {}", readSize, headerSize);
-		return -1;
-	}
-
-	size_t bytes_read = fread(&header, 1, headerSize, file);
-	while (bytes_read == headerSize){
-		if (!isEventSelected(header)){
-			fseek(file, header.eventSize-headerSize, SEEK_CUR);
-		}else{
-			*buffer = (unsigned char *) malloc(header.eventSize);
-			//Come back to the init of event
-			fseek(file, -(long)headerSize, SEEK_CUR);
-			bytes_read = fread(*buffer, 1, header.eventSize, file);
-			//bytes_read += fread(*buffer, 1, header.eventSize-(long)headerSize, file);
-			if (bytes_read != header.eventSize ){
-				//TODO throw art::Exception(art::errors::FileReadError)
+next::DATEStream* next::CopyEvents::openDATEStream(std::vector<std::string> const & filenames)
+{
+	next::DATEStream* stream = new next::DATEStream(filenames, config_, input_->bufferPool());
+	if ( !stream->open() ){
+		bool opened = false;
+		if (config_->follow()){
+			// The DAQ may not have created the file yet
+			for (int waited=0; waited<config_->followTimeout() && !opened; waited++){
+				sleep(1);
+				opened = stream->open();
 			}
-			evt_number = EVENT_ID_GET_NB_IN_RUN(header.eventId);
-			//std::cout << "evt number: " << evt_number << std::endl;
-			break;
 		}
-		bytes_read = fread(&header, 1, headerSize, file);
+		if ( !opened ){
+			// A missing chunk would leave a hole in the copy
+			_log->error("Unable to open specified DATE file {}", filenames[0]);
+			exit(-1);
+		}
 	}
-
-	return evt_number;
+	return stream;
 }
 
-
+// filename can be a single file, a run directory or a glob pattern
 void next::CopyEvents::readFile(std::string const & filename, std::string const & filename_out)
 {
-
-	bool gdc2first = false;
-
-	int nevents1=0, firstEvtGDC1;
-	int nevents2=0, firstEvtGDC2;
-	std::FILE* file1 = NULL;
-	std::FILE* file2 = NULL;
-	std::string filename2 = filename;
-
 	//TODO find out how to refactor the file openings
-	file1 = std::fopen(filename.c_str(), "rb");
-	if ( !file1 ){
-		// TODO Failure to open file: must throw FileOpenError.
+	input_ = new DATEMerger(config_);
+	for (auto const & files : findRunFiles(filename, twoFiles_)){
+		input_->addStream(openDATEStream(files));
 	}
 
 	fout_ = std::fopen(filename_out.c_str(), "w");
@@ -100,44 +63,16 @@ void next::CopyEvents::readFile(std::string const & filename, std::string const
 		// TODO Failure to open file: must throw FileOpenError.
 	}
 
-	countEvents(file1, &nevents1, &firstEvtGDC1);
-
-	if (twoFiles_){
-		filename2.replace(filename2.find("gdc1"), 4, "gdc2");
-
-		file2 = std::fopen(filename2.c_str(), "rb");
-		if ( !file2 ){
-			// TODO Failure to open file: must throw FileOpenError.
-		}
-
-		countEvents(file2, &nevents2, &firstEvtGDC2);
-		//Check which gdc goes first
-		if (firstEvtGDC2 < firstEvtGDC1){
-			gdc2first = true;
-		}
+	entriesThisFile_ = input_->buildIndex();
+	if(!events_.empty()){
+		entriesThisFile_ = events_.size();
+	}else if(!input_->eventsKnown()){
+		// Unknown (follow mode or streams), read until the end of run
+		entriesThisFile_ = max_events_;
 	}
-
-	entriesThisFile_ = nevents1 + nevents2;
 	if(max_events_ < entriesThisFile_){
 		entriesThisFile_ = max_events_;
 	}
-	if(twoFiles_){
-	}
-
-	//Rewind back to the start of the file
-	if (file1) fseek(file1, 0, SEEK_SET);
-	if (file2) fseek(file2, 0, SEEK_SET);
-
-	fptr1_ = file1;
-	fptr2_ = file2;
-
-	if(twoFiles_ && gdc2first){
-		cfptr_ = fptr2_;
-		nextGdc2_ = true; //Changes in readNext()
-	}else{
-		cfptr_ = fptr1_;
-		nextGdc2_ = false;
-	}
 }
 
 bool next::CopyEvents::readNext()
@@ -150,52 +85,52 @@ bool next::CopyEvents::readNext()
 		return false;
 	}
 
-	//Try 2 times. Usually first time will be ok, but if next
-	//event is missing, skip it and go on with the next file
-	for(int files=0;files<2;files++){
-		//Choose file
-		if(twoFiles_){
-			if (nextGdc2_){
-				cfptr_ = fptr2_;
-			}else{
-				cfptr_ = fptr1_;
-			}
-			//Change file for next time
-			nextGdc2_ = !nextGdc2_;
-		}
+	if(!events_.empty()){
+		return copyListedEvent(toSkip);
+	}
 
-		int evt_number = loadNextEvent(cfptr_, &buffer_);
-		if (evt_number > 0){
-			event_ = (eventHeaderStruct*) buffer_;
-			eventNo_++;
-			if(!toSkip){
-				fwrite(buffer_, 1, event_->eventSize , fout_);
-				free(buffer_);
-			}
-			//Unless error (missing event), we should read only one event at a time
-			break;
-		}
+	//Skipped events are not read from disk
+	int evt_number;
+	if(toSkip){
+		evt_number = input_->skipEvent();
+	}else{
+		evt_number = input_->loadNextEvent(&buffer_);
+	}
+	if (evt_number < 0){
+		//No events left in any file
+		return false;
 	}
 
+	eventNo_++;
+	if(!toSkip){
+		event_ = (eventHeaderStruct*) buffer_;
+		fwrite(buffer_, 1, event_->eventSize , fout_);
+		input_->releaseEvent(buffer_);
+	}
 	return eventNo_ < entriesThisFile_;
 }
 
-bool next::CopyEvents::isEventSelected(eventHeaderStruct& event) const
+// Copies the next event of the "events" list from the config, looking
+// for it in the index of each gdc file
+bool next::CopyEvents::copyListedEvent(bool toSkip)
 {
-  if (event.eventType == PHYSICS_EVENT ||
-		  event.eventType == CALIBRATION_EVENT){
-    return true;
-  }
-  return false;
-}
+	int evt_number = events_[eventNo_];
+	eventNo_++;
+	if(toSkip){
+		return eventNo_ < entriesThisFile_;
+	}
 
-unsigned int next::CopyEvents::readHeaderSize(std::FILE* fptr) const
-{
-	unsigned char * buf = new unsigned char[4];
-	eventHeadSizeType size;
-	fseek(fptr, 8, SEEK_CUR);
-	fread(buf, 1, 4, fptr);
-	size = *buf;
-	fseek(fptr, -12, SEEK_CUR);
-	return (unsigned int)size;
+	if(!input_->seekEvent(evt_number)){
+		_log->warn("Event {} not found in input files", evt_number);
+		return eventNo_ < entriesThisFile_;
+	}
+
+	if(input_->loadNextEvent(&buffer_) < 0){
+		_log->error("Unable to read event {}", evt_number);
+		return eventNo_ < entriesThisFile_;
+	}
+	event_ = (eventHeaderStruct*) buffer_;
+	fwrite(buffer_, 1, event_->eventSize , fout_);
+	input_->releaseEvent(buffer_);
+	return eventNo_ < entriesThisFile_;
 }
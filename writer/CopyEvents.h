@@ -12,12 +12,18 @@
 
 #include "navel/DATEEventHeader.hh"
 
+#ifndef _DATEMERGER
+#include "detail/DATEMerger.h"
+#endif
+
 #include "detail/event.h"
 #include <stdint.h>
 #include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <memory>
 #include <numeric>
+#include <unistd.h>
 
 namespace next {
 
@@ -29,24 +35,16 @@ public:
 
   /// Open specified file.
   void readFile(std::string const & filename, std::string const & filename_out);
-  void countEvents(std::FILE* file, int * events, int * firstEvt);
-  int loadNextEvent(std::FILE* file, unsigned char ** buffer);
 
   /// Read an event.
   bool readNext();
 
 private:
-  /// DATE stuff: check if event of desired type.
-  bool isEventSelected(eventHeaderStruct& event) const;
-
-  /// Retrieve DATE event header size stored in the raw data.
-  /// 80 bytes for the newer DAQ (DATE event header format 3.14)
-  unsigned int readHeaderSize(std::FILE* fptr) const;
+  next::DATEStream* openDATEStream(std::vector<std::string> const & filenames);
+  bool copyListedEvent(bool toSkip);
 
   size_t run_;
-  std::FILE* cfptr_; // current fptr
-  std::FILE* fptr1_; // gdc1
-  std::FILE* fptr2_; // gdc2
+  next::DATEMerger* input_; // events of all the gdc files
   std::FILE* fout_; // gdc2
   int entriesThisFile_;
   eventHeaderStruct * event_;      // raw data super event
@@ -54,13 +52,16 @@ private:
   int skip_;
   int max_events_;
   unsigned char* buffer_;
+  std::vector<int> events_; // Event numbers to copy, all if empty
 
   // verbosity control
   unsigned int verbosity_;///< default 0 for quiet output.
 
   //Attributes to read from two files
   bool twoFiles_; // If true, gdc1 & gdc2 will be read
-  bool nextGdc2_; // If true, next event will be read from gdc2
+
+  ReadConfig * config_;
+  std::shared_ptr<spdlog::logger> _log;
 
 };
 